@@ -8,6 +8,7 @@
 //External EEPROM: 24C65                                         //
 ///////////////////////////////////////////////////////////////////
 //  Compiler:         ARM GCC TOOLCHAIN                          //
+//  Sources:          8-band-trx2.c, trx_core.c                  //
 //  Author:           Peter Baier (DK7IH)                        //
 //                    JUL 2022                                   // 
 ///////////////////////////////////////////////////////////////////
@@ -17,14 +18,18 @@
 //170:128: Frequency data for 8 bands (7:0) x 2 VFOs x 4 bytes
 //171: l.LO.LSB stored as "Band8, VFO0"
 //172: l.LO.USB stored as "Band8, VFO1"
+//203:200: DDS reference clock stored as "Band9, VFO0"
 //256: Last band used
 //257: Last VFO used
+//8191:1024: Persistence log, 96 byte records (see persist_flush())
 
 //PORTS:
 //I²C: PB6(SCK), PB9(SDA)
 
 //DDS: PB15:PB12
+//DDS with DDS_HW_SPI: SPI2 SCK PB13, MOSI PB15, RESET PB14, IO_UD PB12
 //LCD: PA3:PA0
+//LCD with LCD_HW_SPI: SPI1 SCK PB3, MOSI PB5, DC PA2, RST PA3
 //Band relays: A10:A12
 
 //Inputs:
@@ -36,11 +41,17 @@
 //TMP: PA7 (analog)
 
 //TX/RX indicator
-//PB3
+//PB3 (PA0 with LCD_HW_SPI)
+
+//CAT
+//USART1 TX PA15, RX PB7
+
+//Rotary encoder
+//PA8, PA9 (TIM1 CH1, CH2) with ENC_HW_TIMER, PB0, PB1 otherwise
 
 #include "stm32f4xx.h"
-#include <stdlib.h>
-#include <math.h>
+#include "trx_core.h" //Portable part (drawing, tuning math, S-meter), hardware seam in trx_hal.h
+#include <math.h>     //No <stdlib.h>: display path must stay heap free
 
 //Radio defines
 //Modes and Bands
@@ -48,259 +59,132 @@
 #define MAXBANDS 8
 
 //SPI AD9951 defines
+#define DDS_HW_SPI  //SPI2 + DMA1 transport for DDS, comment out for bit-banged GPIO
 #define DDS_GPIO GPIOB
+#ifdef DDS_HW_SPI
+#define DDS_IO_UD   12   //yellow
+#define DDS_SCLK    13   //blue,  AF5 SPI2_SCK
+#define DDS_RESET   14   //gray
+#define DDS_SDIO    15   //white, AF5 SPI2_MOSI
+#else
 #define DDS_IO_UD   12   //yellow
 #define DDS_SDIO    13   //white
 #define DDS_SCLK    14   //blue
 #define DDS_RESET   15   //gray
+#endif
 
 //24C65
 #define EEPROM_ADR 0xA0
 #define EEPROMSIZE 8192
+#define EEPROM_PAGESIZE 32 //Page write buffer, writes must not cross a page boundary
 
 //Defines for Si5351
 #define SI5351_ADR 0xC0     //Check individual module for correct address setting. IDs may vary!
-#define FXTAL          25000000 //Hz
-#define PLLRATIO       32       //FXTAL * PLLRATIO = f.VCO
-
-//Set of Si5351A relevant register addresses
-#define CLK_ENABLE_CONTROL          3
-#define PLLX_SRC				   15
-#define CLK0_CONTROL               16 
-#define CLK1_CONTROL               17
-#define CLK2_CONTROL               18
-#define SYNTH_PLL_A                26
-#define SYNTH_PLL_B                34
-#define SYNTH_MS_0                 42
-#define SYNTH_MS_1                 50
-#define SYNTH_MS_2                 58
-#define SPREAD_SPECTRUM_PARAMETERS 149
-#define PLL_RESET                  177
-#define XTAL_LOAD_CAP              183
+
+//Profiling
+//#define PROFILE      //DWT cycle probes and diagnostic page (long press key 2), compiles to nothing when commented out
+
+//Rotary encoder
+#define ENC_HW_TIMER //TIM1 encoder mode on PA8/PA9, comment out for EXTI0 on PB0/PB1
+#ifdef ENC_HW_TIMER
+#define ENC_DIV        4   //Counts per detent (both edges of both channels)
+#else
+#define ENC_DIV        1   //Rising edge of PB0 only
+#endif
+#define ENC_VEL_FILTER 8   //Velocity smoothing, 1/n of each 10ms sample
 
 //SPI ST7735 defines
+#define LCD_HW_SPI   //SPI1 + DMA2 transport for LCD, comment out for bit-banged GPIO
+//#define LCD_FRAMEBUFFER //Draw into RAM, changed rows are flushed by DMA (needs LCD_HW_SPI, 68kB RAM)
+#if defined(LCD_FRAMEBUFFER) && !defined(LCD_HW_SPI)
+#error LCD_FRAMEBUFFER needs LCD_HW_SPI
+#endif
 #define LCD_GPIO GPIOA
 #define CLK    0 //yellow
 #define DATA   1 //freen 
 #define DC_AO  2 //white
 #define RST    3 //gray
 
-//LCD ST7735 contants
-#define ST7735_NOP     0x00
-#define ST7735_SWRESET 0x01
-#define ST7735_RDDID   0x04
-#define ST7735_RDDST   0x09
-#define ST7735_SLPIN   0x10
-#define ST7735_SLPOUT  0x11
-#define ST7735_PTLON   0x12
-#define ST7735_NORON   0x13
-#define ST7735_INVOFF  0x20
-#define ST7735_INVON   0x21
-#define ST7735_DISPOFF 0x28
-#define ST7735_DISPON  0x29
-#define ST7735_CASET   0x2A
-#define ST7735_RASET   0x2B
-#define ST7735_RAMWR   0x2C
-#define ST7735_RAMRD   0x2E
-#define ST7735_PTLAR   0x30
-#define ST7735_COLMOD  0x3A
-#define ST7735_MADCTL  0x36
-#define ST7735_FRMCTR1 0xB1
-#define ST7735_FRMCTR2 0xB2
-#define ST7735_FRMCTR3 0xB3
-#define ST7735_INVCTR  0xB4
-#define ST7735_DISSET5 0xB6
-#define ST7735_PWCTR1  0xC0
-#define ST7735_PWCTR2  0xC1
-#define ST7735_PWCTR3  0xC2
-#define ST7735_PWCTR4  0xC3
-#define ST7735_PWCTR5  0xC4
-#define ST7735_VMCTR1  0xC5
-#define ST7735_RDID1   0xDA
-#define ST7735_RDID2   0xDB
-#define ST7735_RDID3   0xDC
-#define ST7735_RDID4   0xDD
-#define ST7735_PWCTR6  0xFC
-#define ST7735_GMCTRP1 0xE0
-#define ST7735_GMCTRN1 0xE1
-//Some sample colors
-//USeful website http://www.barth-dev.de/online/rgb565-color-picker/
-#define WHITE        0xFFFF
-#define BLACK        0x0000
-#define GRAY         0x94B2
-#define LIGHTGRAY    0xC5D7
-
-#define LIGHTBLUE    0x755C
-#define BLUE         0x3C19
-#define DARKBLUE     0x0A73
-#define DARKBLUE2    0x20AA
-
-#define LIGHTRED     0xFA60 //0xE882 // 0xEB2D //0xDAAB
-#define RED          0xF803 //0xB1A7
-#define DARKRED      0x80C3
-
-#define LIGHTGREEN   0x27E0 //0x6E84
-#define GREEN        0x07EA //0x6505
-#define DARKGREEN    0x3B04
-
-#define LIGHTVIOLET  0xAC19
-#define LIGHTVIOLET2 0x9BD9
-#define VIOLET       0x71B6
-#define DARKVIOLET   0x48AF
-
-#define DARKYELLOW   0xB483
-#define YELLOW       0xFF00 //0xE746  0xFD40
-#define YELLOW2      0xFEC0
-#define LIGHTYELLOW  0xF7E0 //0xF752  //0xF7AF
-
-#define LIGHTBROWN   0xF64F
-#define BROWN        0x9323
-#define DARKBROWN    0x6222
-
-
-//Font
-#define FONTWIDTH 8 
-#define FONTHEIGHT 12
-
-#define CHAROFFSET 0x20
-const unsigned char xchar[][FONTHEIGHT] ={
-{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x20
-{0x00,0x0C,0x1E,0x1E,0x1E,0x0C,0x0C,0x00,0x0C,0x0C,0x00,0x00},	// 0x21
-{0x00,0x66,0x66,0x66,0x24,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x22
-{0x00,0x36,0x36,0x7F,0x36,0x36,0x36,0x7F,0x36,0x36,0x00,0x00},	// 0x23
-{0x0C,0x0C,0x3E,0x03,0x03,0x1E,0x30,0x30,0x1F,0x0C,0x0C,0x00},	// 0x24
-{0x00,0x00,0x00,0x23,0x33,0x18,0x0C,0x06,0x33,0x31,0x00,0x00},	// 0x25
-{0x00,0x0E,0x1B,0x1B,0x0E,0x5F,0x7B,0x33,0x3B,0x6E,0x00,0x00},	// 0x26
-{0x00,0x0C,0x0C,0x0C,0x06,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x27
-{0x00,0x30,0x18,0x0C,0x06,0x06,0x06,0x0C,0x18,0x30,0x00,0x00},	// 0x28
-{0x00,0x06,0x0C,0x18,0x30,0x30,0x30,0x18,0x0C,0x06,0x00,0x00},	// 0x29
-{0x00,0x00,0x00,0x66,0x3C,0xFF,0x3C,0x66,0x00,0x00,0x00,0x00},	// 0x2A
-{0x00,0x00,0x00,0x18,0x18,0x7E,0x18,0x18,0x00,0x00,0x00,0x00},	// 0x2B
-{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x1C,0x1C,0x06,0x00},	// 0x2C
-{0x00,0x00,0x00,0x00,0x00,0x7F,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x2D
-{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x1C,0x1C,0x00,0x00},	// 0x2E
-{0x00,0x00,0x40,0x60,0x30,0x18,0x0C,0x06,0x03,0x01,0x00,0x00},	// 0x2F
-{0x00,0x3E,0x63,0x63,0x63,0x6B,0x63,0x63,0x63,0x3E,0x00,0x00},	// 0x30
-{0x00,0x08,0x0C,0x0F,0x0C,0x0C,0x0C,0x0C,0x0C,0x3F,0x00,0x00},	// 0x31
-{0x00,0x1E,0x33,0x33,0x30,0x18,0x0C,0x06,0x33,0x3F,0x00,0x00},	// 0x32
-{0x00,0x1E,0x33,0x30,0x30,0x1C,0x30,0x30,0x33,0x1E,0x00,0x00},	// 0x33
-{0x00,0x30,0x38,0x3C,0x36,0x33,0x7F,0x30,0x30,0x78,0x00,0x00},	// 0x34
-{0x00,0x3F,0x03,0x03,0x03,0x1F,0x30,0x30,0x33,0x1E,0x00,0x00},	// 0x35
-{0x00,0x1C,0x06,0x03,0x03,0x1F,0x33,0x33,0x33,0x1E,0x00,0x00},	// 0x36
-{0x00,0x7F,0x63,0x63,0x60,0x30,0x18,0x0C,0x0C,0x0C,0x00,0x00},	// 0x37
-{0x00,0x1E,0x33,0x33,0x33,0x1E,0x33,0x33,0x33,0x1E,0x00,0x00},	// 0x38
-{0x00,0x1E,0x33,0x33,0x33,0x3E,0x18,0x18,0x0C,0x0E,0x00,0x00},	// 0x39
-{0x00,0x00,0x00,0x1C,0x1C,0x00,0x00,0x1C,0x1C,0x00,0x00,0x00},	// 0x3A
-{0x00,0x00,0x00,0x1C,0x1C,0x00,0x00,0x1C,0x1C,0x18,0x0C,0x00},	// 0x3B
-{0x00,0x30,0x18,0x0C,0x06,0x03,0x06,0x0C,0x18,0x30,0x00,0x00},	// 0x3C
-{0x00,0x00,0x00,0x00,0x7E,0x00,0x7E,0x00,0x00,0x00,0x00,0x00},	// 0x3D
-{0x00,0x06,0x0C,0x18,0x30,0x60,0x30,0x18,0x0C,0x06,0x00,0x00},	// 0x3E
-{0x00,0x1E,0x33,0x30,0x18,0x0C,0x0C,0x00,0x0C,0x0C,0x00,0x00},	// 0x3F
-{0x00,0x3E,0x63,0x63,0x7B,0x7B,0x7B,0x03,0x03,0x3E,0x00,0x00},	// 0x40
-{0x00,0x0C,0x1E,0x33,0x33,0x33,0x3F,0x33,0x33,0x33,0x00,0x00},	// 0x41
-{0x00,0x3F,0x66,0x66,0x66,0x3E,0x66,0x66,0x66,0x3F,0x00,0x00},	// 0x42
-{0x00,0x3C,0x66,0x63,0x03,0x03,0x03,0x63,0x66,0x3C,0x00,0x00},	// 0x43
-{0x00,0x1F,0x36,0x66,0x66,0x66,0x66,0x66,0x36,0x1F,0x00,0x00},	// 0x44
-{0x00,0x7F,0x46,0x06,0x26,0x3E,0x26,0x06,0x46,0x7F,0x00,0x00},	// 0x45
-{0x00,0x7F,0x66,0x46,0x26,0x3E,0x26,0x06,0x06,0x0F,0x00,0x00},	// 0x46
-{0x00,0x3C,0x66,0x63,0x03,0x03,0x73,0x63,0x66,0x7C,0x00,0x00},	// 0x47
-{0x00,0x33,0x33,0x33,0x33,0x3F,0x33,0x33,0x33,0x33,0x00,0x00},	// 0x48
-{0x00,0x1E,0x0C,0x0C,0x0C,0x0C,0x0C,0x0C,0x0C,0x1E,0x00,0x00},	// 0x49
-{0x00,0x78,0x30,0x30,0x30,0x30,0x33,0x33,0x33,0x1E,0x00,0x00},	// 0x4A
-{0x00,0x67,0x66,0x36,0x36,0x1E,0x36,0x36,0x66,0x67,0x00,0x00},	// 0x4B
-{0x00,0x0F,0x06,0x06,0x06,0x06,0x46,0x66,0x66,0x7F,0x00,0x00},	// 0x4C
-{0x00,0x63,0x77,0x7F,0x7F,0x6B,0x63,0x63,0x63,0x63,0x00,0x00},	// 0x4D
-{0x00,0x63,0x63,0x67,0x6F,0x7F,0x7B,0x73,0x63,0x63,0x00,0x00},	// 0x4E
-{0x00,0x1C,0x36,0x63,0x63,0x63,0x63,0x63,0x36,0x1C,0x00,0x00},	// 0x4F
-{0x00,0x3F,0x66,0x66,0x66,0x3E,0x06,0x06,0x06,0x0F,0x00,0x00},	// 0x50
-{0x00,0x1C,0x36,0x63,0x63,0x63,0x73,0x7B,0x3E,0x30,0x78,0x00},	// 0x51
-{0x00,0x3F,0x66,0x66,0x66,0x3E,0x36,0x66,0x66,0x67,0x00,0x00},	// 0x52
-{0x00,0x1E,0x33,0x33,0x03,0x0E,0x18,0x33,0x33,0x1E,0x00,0x00},	// 0x53
-{0x00,0x3F,0x2D,0x0C,0x0C,0x0C,0x0C,0x0C,0x0C,0x1E,0x00,0x00},	// 0x54
-{0x00,0x33,0x33,0x33,0x33,0x33,0x33,0x33,0x33,0x1E,0x00,0x00},	// 0x55
-{0x00,0x33,0x33,0x33,0x33,0x33,0x33,0x33,0x1E,0x0C,0x00,0x00},	// 0x56
-{0x00,0x63,0x63,0x63,0x63,0x6B,0x6B,0x36,0x36,0x36,0x00,0x00},	// 0x57
-{0x00,0x33,0x33,0x33,0x1E,0x0C,0x1E,0x33,0x33,0x33,0x00,0x00},	// 0x58
-{0x00,0x33,0x33,0x33,0x33,0x1E,0x0C,0x0C,0x0C,0x1E,0x00,0x00},	// 0x59
-{0x00,0x7F,0x73,0x19,0x18,0x0C,0x06,0x46,0x63,0x7F,0x00,0x00},	// 0x5A
-{0x00,0x3C,0x0C,0x0C,0x0C,0x0C,0x0C,0x0C,0x0C,0x3C,0x00,0x00},	// 0x5B
-{0x00,0x00,0x01,0x03,0x06,0x0C,0x18,0x30,0x60,0x40,0x00,0x00},	// 0x5C
-{0x00,0x3C,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x3C,0x00,0x00},	// 0x5D
-{0x08,0x1C,0x36,0x63,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x5E
-{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xFF,0x00},	// 0x5F
-{0x0C,0x0C,0x18,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x60
-{0x00,0x00,0x00,0x00,0x1E,0x30,0x3E,0x33,0x33,0x6E,0x00,0x00},	// 0x61
-{0x00,0x07,0x06,0x06,0x3E,0x66,0x66,0x66,0x66,0x3B,0x00,0x00},	// 0x62
-{0x00,0x00,0x00,0x00,0x1E,0x33,0x03,0x03,0x33,0x1E,0x00,0x00},	// 0x63
-{0x00,0x38,0x30,0x30,0x3E,0x33,0x33,0x33,0x33,0x6E,0x00,0x00},	// 0x64
-{0x00,0x00,0x00,0x00,0x1E,0x33,0x3F,0x03,0x33,0x1E,0x00,0x00},	// 0x65
-{0x00,0x1C,0x36,0x06,0x06,0x1F,0x06,0x06,0x06,0x0F,0x00,0x00},	// 0x66
-{0x00,0x00,0x00,0x00,0x6E,0x33,0x33,0x33,0x3E,0x30,0x33,0x1E},	// 0x67
-{0x00,0x07,0x06,0x06,0x36,0x6E,0x66,0x66,0x66,0x67,0x00,0x00},	// 0x68
-{0x00,0x18,0x18,0x00,0x1E,0x18,0x18,0x18,0x18,0x7E,0x00,0x00},	// 0x69
-{0x00,0x30,0x30,0x00,0x3C,0x30,0x30,0x30,0x30,0x33,0x33,0x1E},	// 0x6A
-{0x00,0x07,0x06,0x06,0x66,0x36,0x1E,0x36,0x66,0x67,0x00,0x00},	// 0x6B
-{0x00,0x1E,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x7E,0x00,0x00},	// 0x6C
-{0x00,0x00,0x00,0x00,0x3F,0x6B,0x6B,0x6B,0x6B,0x63,0x00,0x00},	// 0x6D
-{0x00,0x00,0x00,0x00,0x1F,0x33,0x33,0x33,0x33,0x33,0x00,0x00},	// 0x6E
-{0x00,0x00,0x00,0x00,0x1E,0x33,0x33,0x33,0x33,0x1E,0x00,0x00},	// 0x6F
-{0x00,0x00,0x00,0x00,0x3B,0x66,0x66,0x66,0x66,0x3E,0x06,0x0F},	// 0x70
-{0x00,0x00,0x00,0x00,0x6E,0x33,0x33,0x33,0x33,0x3E,0x30,0x78},	// 0x71
-{0x00,0x00,0x00,0x00,0x37,0x76,0x6E,0x06,0x06,0x0F,0x00,0x00},	// 0x72
-{0x00,0x00,0x00,0x00,0x1E,0x33,0x06,0x18,0x33,0x1E,0x00,0x00},	// 0x73
-{0x00,0x00,0x04,0x06,0x3F,0x06,0x06,0x06,0x36,0x1C,0x00,0x00},	// 0x74
-{0x00,0x00,0x00,0x00,0x33,0x33,0x33,0x33,0x33,0x6E,0x00,0x00},	// 0x75
-{0x00,0x00,0x00,0x00,0x33,0x33,0x33,0x33,0x1E,0x0C,0x00,0x00},	// 0x76
-{0x00,0x00,0x00,0x00,0x63,0x63,0x6B,0x6B,0x36,0x36,0x00,0x00},	// 0x77
-{0x00,0x00,0x00,0x00,0x63,0x36,0x1C,0x1C,0x36,0x63,0x00,0x00},	// 0x78
-{0x00,0x00,0x00,0x00,0x66,0x66,0x66,0x66,0x3C,0x30,0x18,0x0F},	// 0x79
-{0x00,0x00,0x00,0x00,0x3F,0x31,0x18,0x06,0x23,0x3F,0x00,0x00},	// 0x7A
-{0x00,0x38,0x0C,0x0C,0x06,0x03,0x06,0x0C,0x0C,0x38,0x00,0x00},	// 0x7B
-{0x00,0x18,0x18,0x18,0x18,0x00,0x18,0x18,0x18,0x18,0x00,0x00},	// 0x7C
-{0x00,0x07,0x0C,0x0C,0x18,0x30,0x18,0x0C,0x0C,0x07,0x00,0x00},	// 0x7D
-{0x00,0xCE,0x5B,0x73,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x7E
-{0x00,0x00,0x00,0x08,0x1C,0x36,0x63,0x63,0x7F,0x00,0x00,0x00},	// 0x7F
-{0x00,0x1E,0x33,0x33,0x03,0x03,0x03,0x33,0x33,0x1E,0x0C,0x06},	// 0x80
-{0x00,0x00,0x00,0x00,0xFF,0xFF,0xFF,0xFF,0x00,0x00,0x00,0x00},	// 0x81 S-Meter bar block
-{0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10},	// 0x82 |
-{0x00,0x00,0x00,0x00,0x00,0x00,0xFF,0x00,0x00,0x00,0x00,0x00},	// 0x83 -
-{0x10,0x10,0x10,0x10,0x10,0x10,0xF0,0x00,0x00,0x00,0x00,0x00},	// 0x84 '-
-{0x10,0x10,0x10,0x10,0x10,0x10,0x1F,0x00,0x00,0x00,0x00,0x00},	// 0x85 -'
-{0x00,0x00,0x00,0x00,0x00,0x00,0xF0,0x10,0x10,0x10,0x10,0x10},	// 0x86 ;-
-{0x00,0x00,0x00,0x00,0x00,0x00,0x1F,0x10,0x10,0x10,0x10,0x10},	// 0x87 -;
-{0x00,0x08,0x14,0x08,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x88 ° 
-};
-
-//ADC defines
-#define KEYS  1 //ADC channel 4 - PA4
-#define VDD   2 //ADC channel 5 - PA5
-#define MTR   3 //ADC channel 6 - PA6
-#define TMP   4 //ADC channel 7 - PA7
+#ifdef LCD_HW_SPI
+#define LCD_SPI_GPIO GPIOB
+#define LCD_SPI_SCK  3 //yellow, AF5 SPI1_SCK 
+#define LCD_SPI_MOSI 5 //green,  AF5 SPI1_MOSI
+#define TXRX_GPIO    GPIOA //PB3 is taken by SPI1_SCK, TX/RX sense moves to PA0
+#define TXRX_PIN     0
+#else
+#define TXRX_GPIO    GPIOB
+#define TXRX_PIN     3
+#endif
+
+
+
+//ADC1 scans channels 4:7 continuously, DMA2 stream 0 stores
+//ADC_AVG scans in circular buffer adc_buf
+#define ADC_CHANNELS 4
+#define ADC_AVG      4 //Scans averaged per reading
+//Sample time per channel (SMPx code): 0 = 3, 1 = 15, 2 = 28, 3 = 56,
+//4 = 84, 5 = 112, 6 = 144, 7 = 480 ADC cycles
+#define ADC_SMP_KEYS 7
+#define ADC_SMP_VDD  7
+#define ADC_SMP_MTR  7
+#define ADC_SMP_TMP  7
+
+//Telemetry: VDD and PA temperature from adc_buf, IIR filtered in Q4
+//(12 bit ADC << 4), converted in fixed point, posted on change only
+#define TEL_PERIOD      100   //ms between filter updates
+#define TEL_FILTER        3   //IIR shift, time constant 2^3 * TEL_PERIOD
+#define TEL_VDD_SCALE  3630   //0.01V at ADC full scale: 3.3V * 11 (divider) * 100, calibrate here
+#define TEL_VDD_HYST      3   //0.01V beyond half a display step until display follows
+#define TEL_TMP_HYST      3   //0.1°C
+#define TEL_VDD_LOW     105   //0.1V, alert below
+#define TEL_PA_WARN      40   //°C, yellow
+#define TEL_PA_ALERT     60   //°C, red and alert
+#define TEL_ALERT_REPEAT 10000 //ms between repeated alert messages
+//KTY81-210 from 3.3V through 1k: ADC = 4096 * R / (1k + R), R from data
+//sheet table at TEL_KTY_T0 + n * TEL_KTY_STEP °C, linear in between
+#define TEL_KTY_T0      -20
+#define TEL_KTY_STEP     10
+#define TEL_KTY_N        15
 
 ////////////////////////////
 // Declarations functions //
 ////////////////////////////
 //MISC
 int main(void);
-static void delay (unsigned int);
 void set_band_relay(int);
+void band_prepare(void);
+void band_switch(int);
+void sideband_select(int);
+void vfo_select(int);
+int vfo_set_freq(int, long);
+void cat_init(void);
+void cat_putc(char);
+void cat_puts(const char*);
+void cat_putnum(long, int);
+void cat_flush(void);
+void cat_exec(char*, int);
+void task_cat(void);
+void mem_prepare(void);
+void mem_load(void);
+int mem_store(long, int, int);
+void mem_push(struct mem_chan*);
+void scan_start(int);
+void scan_stop(void);
+void task_scan(void);
 
 //ST7735 LCD
 void lcd_reset(void);                                    //Reset LCD
-void lcd_write_command(int);                             //Send a command to LCD
-void lcd_write_data(int);                                //Send data to LCD
-void lcd_setwindow(int, int, int, int);                  //Define output window on LCD
-void lcd_setpixel(int, int, unsigned int);               //Set 1 Pixel
+#ifdef LCD_FRAMEBUFFER
+void lcd_fb_begin(void);                                 //Redirect drawing to framebuffer
+void lcd_fb_flush(void);                                 //Send next changed rectangle
+#endif
 void lcd_cls(unsigned int);                              //Clear LCD
 unsigned int lcd_16bit_color(int, int, int);             //Define color value (int) from red, green and blue
-void lcd_putchar(int, int, unsigned char, unsigned int, unsigned int, int, int); //Write one char to LCD (double size, variable height)
-void lcd_putstring(int, int, char*, unsigned int, unsigned int, int, int);       //Write \0 terminated string to LCD (double size, variable height)
-int lcd_putnumber(int, int, long, int, int, int, int, int);                     //Write a number (int or long) to LCD (double size, variable height)
 void show_msg(char*, int);
+void show_key(int);
 void show_txrx(void);
 
 //STRING FUNCTIONS
-int int2asc(long, int, char*, int);                                     //Convert an int or long number to a string
 int strlen(char *);                                                     //Calculate length of string 
 
 //Radio display functions
@@ -311,63 +195,160 @@ void show_sideband(int, int);
 void show_vfo(int, int, int);
 void show_voltage(int);
 void show_pa_temp(int);
-void show_msg(char*);
 int calc_xpos(int);
 int calc_ypos(int);
-void draw_hor_line(int, int, int, int);
-void draw_vert_line(int, int, int, int);
 void show_meter(int);
-void draw_meter_bar(int, int, int);
 void draw_meter_scale(int);
+void draw_frequency1(long, int);
+void draw_frequency2(long);
+void draw_band(int, int);
+void draw_sideband(int, int);
+void draw_vfo(int, int);
+void draw_voltage(int);
+void draw_pa_temp(int);
+void draw_msg(char*, int, int);
+void draw_txrx(int);
+
+//Render queue
+void rq_post(int, long, int, int, const char*);
+int render_poll(void);
+void task_keys(void);
+void task_meter(void);
+void task_msg(void);
+void task_txrx(void);
+void task_telemetry(void);
+void task_render(void);
+void page_close(void);
+void sched_init(void);
+void time_init(void);
+int clk_check(const struct clk_profile*);
+int clk_spi_br(unsigned long, unsigned long);
+int clk_apply(int);
+void clk_peripherals(void);
+void i2c_timing(void);
+#ifdef PROFILE
+void prof_add(int, unsigned long);
+void prof_latency(void);
+void prof_page(void);
+void task_prof(void);
+#endif
+void draw_screen(void);
+void redraw_screen(void);
+void scope_page(void);
+void task_scope(void);
+void scope_column(int, int);
+unsigned long micros(void);
+void delay_us(unsigned long);
+void delay_ms(unsigned long);
+unsigned long deadline(unsigned long);
+int expired(unsigned long);
+void sched_run(void);
+void sched_idle(unsigned long);
+void sleep_gating(void);
+void key_sleep(void);
+uint32_t atomic_add(volatile uint32_t*, int32_t);
+uint32_t atomic_xchg(volatile uint32_t*, uint32_t);
+int spsc_put(struct spsc*, uint8_t);
+int spsc_get(struct spsc*);
+void enc_scan(void);
+long enc_get(void);
+void tune_vfo(void);
 
 //DDS
-void set_frequency(unsigned long);
 void spi_send_bit(int);
+void dds_calibrate(unsigned long, unsigned long);
 
 //ADC
-int get_adc(int);
+void adc_init(void);
+int key_decode(int);
+void key_scan(void);
+void key_put(int);
+int key_get(void);
 int get_keys(void);
 int get_pa_temp(void);
 int get_vdd(void);
-int get_sval(void);
+void tel_update(void);
+int tel_vdd100(void);
+int tel_tmp10(void);
 int get_txpwr(void);
 int get_txrx(void);
 
 
 //I²C
-void i2c_start(void);
-void i2c_stop(void); 
+void i2c_init(void);
+struct i2c_xfer *i2c_submit(int, uint8_t*, int, uint8_t*, int, void (*)(struct i2c_xfer*), int);
+int i2c_wait(struct i2c_xfer*);
+void i2c_poll(void);
 void i2c_write_byte1(uint8_t, uint8_t, int);
 void i2c_write_byte2(uint8_t*, uint8_t, int); 
-int16_t i2c_read(uint8_t); 
+int16_t i2c_read(uint8_t, int); 
+int16_t i2c_read2(uint16_t, int); 
 
 //Si5351
-void si5351_start(void);
-void si5351_set_freq(int, long);
-int set_lo(int);
+void set_lo(int);
+void lo_close(int);
 
 //Interrupt handlers
 extern "C" void EXTI0_IRQHandler(void);
-extern "C" void TIM2_IRQHandler(void);
+extern "C" void SysTick_Handler(void);
+extern "C" void ADC_IRQHandler(void);
+extern "C" void DMA2_Stream3_IRQHandler(void);
+extern "C" void DMA1_Stream4_IRQHandler(void);
+extern "C" void DMA1_Stream0_IRQHandler(void);
+extern "C" void I2C1_EV_IRQHandler(void);
+extern "C" void I2C1_ER_IRQHandler(void);
 
 //EEPROM
+void eeprom_write_page(uint16_t, uint8_t*, int);
+void eeprom_read_seq(uint16_t, uint8_t*, int);
 void eeprom_write(uint16_t, uint8_t);
 uint8_t eeprom_read(uint16_t);
+void eeprom_put_long(uint8_t*, long);
+long eeprom_get_long(uint8_t*);
 int is_freq_ok(long, int);
 void save_all_vfos(void);
-void load_all_vfos(void);
 void eeprom_store_frequency(int, int, long);
 long eeprom_load_frequency(int, int);
 
+//Persistence log
+uint16_t crc16(uint8_t*, int);
+void persist_touch(void);
+void persist_flush(void);
+void persist_poll(void);
+int persist_load(void);
+int boot_load(void);
+
 //Variables
 //LCD
-unsigned int backcolor = DARKBLUE2;
+uint16_t lcd_fillcolor;          //Source for DMA fills, must stay valid while transfer runs
+volatile int lcd_dma_busy = 0;
+#define LCD_RST_PULSE   20    //us RST low, ST7735 needs >= 10us
+#define LCD_RST_WAIT   120    //ms from reset release to first command
+unsigned long lcd_ready = 0;
+
+#ifdef LCD_FRAMEBUFFER
+//Frame composed in lcd_fb, dirty rectangle copied to lcd_fb_tx and sent
+//from there, so drawing goes on while DMA runs
+#define LCD_FB_W 132
+#define LCD_FB_H 132
+uint16_t lcd_fb[LCD_FB_W * LCD_FB_H];
+uint16_t lcd_fb_tx[LCD_FB_W * LCD_FB_H];
+uint8_t lcd_fb_dx0[LCD_FB_H], lcd_fb_dx1[LCD_FB_H]; //Changed columns per row, dx0 > dx1: clean
+int lcd_fb_on = 0;
+int lcd_fb_wx0, lcd_fb_wy0, lcd_fb_wx1, lcd_fb_wy1; //Window of lcd_setwindow()
+int lcd_fb_cx, lcd_fb_cy;                           //RAM write position
+#endif
 
 //VFO data & frequencies
 int cur_vfo;
 int cur_band;
 int sideband;
 long f_lo[2];
+
+//Precomputed per band/sideband by band_prepare()
+uint32_t band_bsrr[MAXBANDS]; //GPIOA BSRR word for band relays
+uint8_t si5351_lo[2][8];      //PLLA registers for f_lo
+uint8_t si5351_ms_lo[8];      //Multisynth registers, one even divider for both f_lo
 long f_vfo[MAXBANDS][2];
 long f_vfo0[MAXBANDS][2] = {{ 1888000,  1961000},	
 	                        { 3650000,  3650000}, 
@@ -382,31 +363,558 @@ long f_cntr[] =  {1840000, 3650000, 7120000, 14180000, 18100000, 21290000, 24931
 long band_f0[] = {1810000, 3500000, 7000000, 14000000, 18065000, 21000000, 24890000, 28000000};  //Band start
 long band_f1[] = {2000000, 3800000, 7200000, 14350000, 18165000, 21465000, 24990000, 29700000};  //Band end
 
-#define INTERFREQUENCY 10000000
+//I2C transaction queue
+#define I2C_QUEUE     8  //Slots, one is kept free
+#define I2C_XBUF     (2 + EEPROM_PAGESIZE) //Max. bytes in write phase
+#define I2C_TIMEOUT  50  //ms per transaction
+#define I2C_BUSY      1
+#define I2C_OK        0
+#define I2C_ERR      -1
+#define I2C_TIMEDOUT -2
+#define I2C_PH_WRITE  0
+#define I2C_PH_READ   1
+#define I2C_ACKPOLL   1  //Flag: repeat start while device NACKs its address (EEPROM write cycle)
+struct i2c_xfer
+{
+	uint8_t adr;                         //Device address (write)
+	uint8_t wbuf[I2C_XBUF];              //Register address and data
+	uint8_t wlen;
+	uint8_t *rbuf;                       //Destination of read phase
+	uint8_t rlen;
+	void (*done)(struct i2c_xfer*);      //Called on completion (ISR context)
+	uint8_t flags;                       //I2C_ACKPOLL
+	volatile int status;                 //I2C_BUSY until done
+};
+struct i2c_xfer i2c_q[I2C_QUEUE];
+struct i2c_xfer * volatile i2c_cur = 0;  //Transaction on the bus
+volatile int i2c_head = 0, i2c_tail = 0, i2c_active = 0, i2c_phase;
+volatile int i2c_acked;                  //Address of current phase acknowledged
+volatile unsigned long i2c_deadline;
+
+//Persistence log in EEPROM 8191:1024
+#define PERSIST_BASE    1024
+#define PERSIST_RECSIZE   96  //3 pages per record
+#define PERSIST_SLOTS   ((EEPROMSIZE - PERSIST_BASE) / PERSIST_RECSIZE)
+#define PERSIST_LEN     (8 + MAXBANDS * 8 + 8 + 2) //Used bytes incl. CRC
+#define PERSIST_MAGIC   0xA5
+#define PERSIST_QUIET   3000  //ms without change before flush
+
+int persist_dirty = 0;
+int persist_slot = -1;        //Slot of newest record
+unsigned long persist_seq = 0;
+
+//ADC: DMA2 stream 0 target, ADC_AVG scans of ADC_CHANNELS
+volatile uint16_t adc_buf[ADC_AVG * ADC_CHANNELS];
+
+//DDS
+uint8_t dds_buf[5];                //Instruction byte + FTW, source for DMA
+volatile int dds_busy = 0;
+
+//Clock profiles, PLL fed by 25MHz HSE
+#define FHSE         25000000
+#define CLK_FULL     0
+#define CLK_LOWNOISE 1
+#define CLK_PROFILES 2
+#define CLK_BOOT     CLK_FULL //Profile set at power up
+#define LCD_SPI_MAX  15000000 //ST7735 write cycle 66ns
+#define DDS_SPI_MAX  25000000 //AD9951
+#define ADC_CLK_MAX  36000000
+#define I2C_SPEED      100000
+#define ADC_PRE ((clk_pclk2 > ADC_CLK_MAX * 2) ? 1 : 0) //ADCPRE: PCLK2 / 4 or / 2
+struct clk_profile
+{
+	const char *name;
+	int pllm, plln, pllp, pllq; //VCO in = FHSE / M, VCO out = in * N, SYSCLK = out / P
+	int hpre, ppre1, ppre2;     //AHB, APB1, APB2 divider: 1, 2, 4, 8, 16
+};
+const struct clk_profile clk_profile[CLK_PROFILES] = {{"CLK 96MHz", 25, 192, 2, 4, 1, 2, 1},  //Rated speed, 3 wait states
+                                                      {"CLK 48MHz", 25, 192, 4, 4, 1, 2, 1}}; //Half speed: less current and digital noise
+unsigned long clk_hclk = 16000000, clk_pclk1 = 16000000, clk_pclk2 = 16000000; //HSI after reset
+int clk_cur = -1;
+
+//CAT interface (Kenwood TS-480 subset) on USART1: TX PA15, RX PB7
+#define CAT_BAUD  9600
+#define CAT_RXBUF   64   //Circular DMA, bytes
+#define CAT_TXBUF  128   //Ring, sent in chunks by DMA
+#define CAT_CMDLEN  16   //Longest command without ';'
+#define CAT_NUM_MAX 999999999 //Largest parameter, above all bands and DDS output
+uint8_t cat_rx[CAT_RXBUF];
+int cat_rx_pos = 0;      //Next byte to parse
+char cat_tx[CAT_TXBUF];
+int cat_tx_head = 0, cat_tx_tail = 0, cat_tx_len = 0; //cat_tx_len: bytes in running DMA transfer
+char cat_cmd[CAT_CMDLEN + 1];
+int cat_cmd_len = 0;
+
+//Telemetry
+const uint16_t tel_kty[TEL_KTY_N] = {2366, 2454, 2539, 2618, 2694, 2766, 2834, 2897, 2957, 3014, 3067, 3117, 3163, 3207, 3246};
+uint32_t tel_vdd_q4 = 0, tel_tmp_q4 = 0;  //Filtered ADC, 0 = not yet sampled
+int tel_vdd_shown = -1;                   //0.1V on screen, -1 = none
+int tel_tmp_shown = -1000;                //°C on screen
+unsigned long tel_alert_next = 0;
+
+//Memory channels in EEPROM MEM_BASE, record: magic, band, sideband, 0,
+//f(4). The RAM copy carries the register images (FTW, relay word, LO
+//image of its sideband), a hop only writes registers
+#define MEM_BASE      512
+#define MEM_CHANNELS   32
+#define MEM_RECSIZE     8
+#define MEM_MAGIC    0x5A
+struct mem_chan
+{
+	long f;                   //0 = empty
+	uint8_t band, sb;
+	unsigned long ftw;        //AD9951 word for f + INTERFREQUENCY
+	uint32_t bsrr;            //Band relay port word
+};
+struct mem_chan mem[MEM_CHANNELS];
+
+//Scanner, runs as scheduler task
+#define SCAN_OFF        0
+#define SCAN_MEM        1     //Stored channels
+#define SCAN_BAND       2     //band_f0 to band_f1 of current band
+#define SCAN_DWELL     30     //ms per channel incl. settling, ~30 channels/s
+#define SCAN_SQUELCH   40     //get_sval() level that holds the scan
+#define SCAN_HANG    2000     //ms scan stays after the signal has gone
+#define SCAN_STEP    1000     //Hz per band scan step
+int scan_mode = SCAN_OFF;
+int scan_dwell = SCAN_DWELL, scan_squelch = SCAN_SQUELCH, scan_step = SCAN_STEP;
+int scan_idx, scan_band, scan_sb;
+long scan_f;
+unsigned long long scan_acc;  //Band scan: FTW * 2^32 of scan_f (+ rounding), stepped by adding
+unsigned long scan_deadline, scan_hold;
+
+//Boot: RF path is set up first, LCD reset runs meanwhile
+#define BOOT_RX_TARGET  100   //ms from SysTick start to DDS, LO and relays set
+#define BOOT_LOCK_WAIT   20   //ms max. for Si5351 PLLA lock
+#define DDS_RST_PULSE    10   //us, AD9951 needs 5 SYSCLK cycles
+unsigned long boot_rx_ms = 0; //Measured time to first RX
+
+//Scheduler
+#define SCHED_TUNE 2    //ms between VFO updates
+#define MSG_TIME 3000   //ms a message stays on screen
+#define PAGE_MAIN  0    //Screen pages, all tasks keep running on any page
+#define PAGE_LO    1    //Main screen, encoder sets LO
+#define PAGE_PROF  2    //From here on full screen pages, drawn directly
+#define PAGE_SCOPE 3
+#define PAGE_FULL  PAGE_PROF
+struct sched_task
+{
+	void (*fn)(void);
+	unsigned int period; //ms, 0 = idle task
+	int prio;
+	unsigned long next;
+};
+volatile unsigned long ms_ticks = 0; //SysTick time base, only SysTick writes, 32-bit reads are atomic
+int page = PAGE_MAIN;                //Full screen page: render queue is held until redraw_screen()
+int lo_sb;                           //PAGE_LO: sideband of LO being set
+long lo_f;                           //          and its frequency
+
+//Profiling probes: cycles per call, latency encoder to DDS
+#ifdef PROFILE
+#define PRF_DDS     0
+#define PRF_FREQ    1
+#define PRF_SI5351  2
+#define PRF_METER   3
+#define PRF_PERSIST 4
+#define PRF_PROBES  5
+#define PRF_LATBINS 8 //<0.25, <0.5, <1, <2, <4, <8, <16, >=16ms
+#define PRF_ROW(r) ((r) * 12) //Text rows of diagnostic page
+struct prof_probe
+{
+	const char *name;
+	unsigned long n, min, max;
+	unsigned long long sum;
+};
+struct prof_probe prof[PRF_PROBES] = {{"DDS", 0, 0xFFFFFFFF, 0, 0},  //min is taken from first sample anyway
+                                      {"FRQ", 0, 0xFFFFFFFF, 0, 0},
+                                      {"SI5", 0, 0xFFFFFFFF, 0, 0},
+                                      {"MTR", 0, 0xFFFFFFFF, 0, 0},
+                                      {"EEP", 0, 0xFFFFFFFF, 0, 0}};
+unsigned long prof_lat[PRF_LATBINS];
+volatile unsigned long prof_enc_c0 = 0; //CYCCNT at first pending detent, 0 = none
+unsigned long prof_idle = 0, prof_win_c0 = 0; //Cycles in WFI since window start
+int prof_idle_pct = 0;                  //Idle share of last window (1s)
+#define PROF_BEGIN()  unsigned long prof_c0 = DWT->CYCCNT
+#define PROF_END(id)  prof_add(id, DWT->CYCCNT - prof_c0)
+
+//Bytes sent/received per bus (struct io_stats in trx_hal.h)
+struct io_stats io_stat;
+#define IO_COUNT(bus, n) io_stat.bus += (n)
+#else
+#define PROF_BEGIN()
+#define PROF_END(id)
+#define IO_COUNT(bus, n)
+#endif
+
+//Single producer, single consumer byte ring between one ISR and main
+//loop. Indices run free, size is a power of 2; the producer only writes
+//head, the consumer only writes tail, so no interrupt locking is needed
+struct spsc
+{
+	volatile uint8_t *buf;
+	uint32_t mask;                 //Size - 1
+	volatile uint32_t head;        //Written by producer
+	volatile uint32_t tail;        //Written by consumer
+};	
+#define SPSC_INIT(b) {b, sizeof(b) - 1, 0, 0}
 
 //Tuning & seconds counting
-int tuning = 0;
-long pulses = 0;
-long runsecs = 0;
-long runsecs_msg = 0;
-long runsecs_smax = 0;
+volatile int enc_count = 0;   //EXTI0 counts (without ENC_HW_TIMER)
+volatile uint32_t enc_hz = 0; //Tuning offset not yet applied (signed Hz, atomic_add/atomic_xchg only)
+int enc_vel = 0;              //Detents per second * 16, filtered
+
+//Acceleration curve: {detents per second, Hz per detent}, Hz is
+//taken from the last entry not faster than the current speed
+#define ENC_CURVE 6
+const int enc_curve[ENC_CURVE][2] = {{0, 1}, {8, 5}, {15, 20}, {25, 100}, {40, 500}, {60, 2000}};
+
+unsigned long msg_deadline = 0; //Restore message line then, 0 = nothing shown
+unsigned long persist_deadline = 0;
+
+//Band scope: SCOPE_W points around the VFO, step Hz apart. Lower part
+//of screen: info line, spectrum line, waterfall (newest line on top)
+#define SCOPE_W       128
+#define SCOPE_SETTLE  400    //us after FTW until the MTR sample is valid (IF filter, detector, ADC_AVG scans)
+#define SCOPE_Y0      39     //calc_ypos(2), rows 0 and 1 stay visible
+#define SCOPE_SPECY   (SCOPE_Y0 + FONTHEIGHT + 5)
+#define SCOPE_SPECH   32     //Spectrum height in px
+#define SCOPE_WFY     (SCOPE_SPECY + SCOPE_SPECH)
+#define SCOPE_WFH     (128 - SCOPE_WFY)
+#define SCOPE_STEPS   5
+const int scope_step[SCOPE_STEPS] = {50, 100, 250, 500, 1000}; //Hz per point
+const uint16_t scope_pal[8] = {BLACK, DARKBLUE, BLUE, DARKGREEN, GREEN, YELLOW, LIGHTRED, WHITE};
+int scope_stepidx = 1;
+uint8_t scope_wf[SCOPE_WFH][SCOPE_W];      //Waterfall lines, ring
+int scope_wftop = 0;                       //Line of current sweep
+int scope_x, scope_step_hz, scope_redraw;  //Column in sweep, Hz per column, 1: new step from next sweep
+long scope_fc, scope_f0;                   //Center and start of current sweep
+unsigned long scope_t;                     //micros() at last FTW
+uint16_t scope_col[SCOPE_SPECH + SCOPE_WFH]; //Pixel column in transfer
+
+//Key events from the key state machine (SysTick, 10ms ticks)
+#define KEY_DEBOUNCE   3   //Ticks level must be stable
+#define KEY_LONG      70   //Ticks for a long press
+#define KEY_QUEUE      8   //Power of 2
+#define KEY_EV_PRESS   0x00
+#define KEY_EV_SHORT   0x10 //Released before KEY_LONG
+#define KEY_EV_LONG    0x20 //Held for KEY_LONG, sent while still held
+#define KEY_EV_MASK    0x30
+#define KEY_AWD_LTR  4000   //Analog watchdog: key ladder below this wakes key scan
+volatile int key_awake = 1; //key_scan() runs, cleared when all keys are released
+volatile uint8_t key_evq_buf[KEY_QUEUE];
+struct spsc key_evq = SPSC_INIT(key_evq_buf);
+
+//Render queue: one slot per screen region, re-posting a pending region
+//only updates its content
+#define RQ_FREQ1    0
+#define RQ_FREQ2    1
+#define RQ_BAND     2
+#define RQ_SIDEBAND 3
+#define RQ_VFO      4
+#define RQ_VOLTAGE  5
+#define RQ_PATEMP   6
+#define RQ_MSG      7
+#define RQ_METER    8
+#define RQ_TXRX     9
+#define RQ_REGIONS 10
+
+#define RQ_CLEAR    1 //Flag: blank region before drawing
+
+struct render_job
+{
+	long val;       //Value to display (frequency, band, voltage...)
+	int arg;        //Size, invert flag or color
+	int flags;      //RQ_CLEAR
+	char txt[17];   //Text for message line
+};
+struct render_job rq_job[RQ_REGIONS];
+unsigned char rq_fifo[RQ_REGIONS];
+int rq_head = 0, rq_cnt = 0;
+unsigned int rq_pending = 0;     //Bit n set: region n is queued
+
+//Called while waiting for LCD transfers  
+void (*lcd_idle_hook)(void) = 0;
+
+//Frequency display: chars last drawn at double size, 0 = unknown
+#define FREQ_DIGITS 7
+char freq_shown[FREQ_DIGITS + 1];
 
-//S-Meter
-#define METERY 86 //Vertical position for S-Meterbar
-int smax = 0;
-int sv_old = 0;
 
 /////////////////////////////
- //  Cheap and dirty delay  //
+ //  Clock tree             //
 /////////////////////////////
-static void delay (unsigned int time) 
+//Profile limits of STM32F411 and no bus or SPI clock (or its harmonics
+//below 30MHz) in a ham band or at the IF. Returns 1 if usable.
+int clk_check(const struct clk_profile *cp)
 {
-    for (unsigned int i = 0; i < time; i++)
-    {
-        for (volatile unsigned int j = 0; j < 2000; j++);
-    }    
+	unsigned long vin = FHSE / cp->pllm, vco = vin * cp->plln, sys = vco / cp->pllp;
+	unsigned long hclk = sys / cp->hpre, pclk1 = hclk / cp->ppre1, pclk2 = hclk / cp->ppre2;
+	unsigned long f[6], fh;
+	int t0, t1;
+	
+	if((vin < 1000000) || (vin > 2000000) || (vco < 100000000) || (vco > 432000000))
+	{
+		return 0;
+	}
+	if((sys > 100000000) || (pclk1 > 50000000) || (pclk2 > 100000000) || (vco / cp->pllq > 48000000))
+	{
+		return 0;
+	}
+	
+	f[0] = hclk;
+	f[1] = pclk1;
+	f[2] = pclk2;
+	f[3] = pclk2 / (2 << clk_spi_br(pclk2, LCD_SPI_MAX));
+	f[4] = pclk1 / (2 << clk_spi_br(pclk1, DDS_SPI_MAX));
+	f[5] = pclk2 / ((pclk2 > ADC_CLK_MAX * 2) ? 4 : 2); //See ADC_PRE
+	for(t0 = 0; t0 < 6; t0++)
+	{
+		for(fh = f[t0]; fh <= 30000000; fh += f[t0])
+		{
+			if((fh > INTERFREQUENCY - 50000) && (fh < INTERFREQUENCY + 50000))
+			{
+				return 0;
+			}
+			for(t1 = 0; t1 < MAXBANDS; t1++)
+			{
+				if(is_freq_ok(fh, t1))
+				{
+					return 0;
+				}
+			}
+		}
+	}
+	return 1;
+}	
+
+//SPI BR[2:0] for fastest clock pclk / 2^(BR+1) not above fmax
+int clk_spi_br(unsigned long pclk, unsigned long fmax)
+{
+	int br = 0;
+	
+	while((br < 7) && (pclk / (2 << br) > fmax))
+	{
+		br++;
+	}
+	return br;
+}	
+
+//Switch clock tree to profile, peripherals follow. 0 if profile is invalid.
+int clk_apply(int prof)
+{
+	const struct clk_profile *cp = &clk_profile[prof];
+	int hpre[] = {0, 0, 8, 0, 9, 0, 0, 0, 10, 0, 0, 0, 0, 0, 0, 0, 11}; //Divider to HPRE code
+	int ppre[] = {0, 0, 4, 0, 5, 0, 0, 0, 6, 0, 0, 0, 0, 0, 0, 0, 7};   //Divider to PPREx code
+	unsigned long ws_max[] = {30000000, 64000000, 90000000}; //HCLK limit for 0:2 wait states at 3.3V
+	unsigned long hclk;
+	int ws = 0;
+	
+	if(!clk_check(cp))
+	{
+		return 0;
+	}
+	hclk = FHSE / cp->pllm * cp->plln / cp->pllp / cp->hpre;
+	while((ws < 3) && (hclk > ws_max[ws]))
+	{
+		ws++;
+	}
+	
+	//Transfers in progress must not see bus clock change
+	lcd_wait();
+	while(dds_busy);
+	while(i2c_active)
+	{
+		i2c_poll();
+	}	
+	
+	//Run from HSI while PLL is reprogrammed
+	RCC->CR |= (1 << 0);                        //HSI on
+	while(!(RCC->CR & (1 << 1)));
+	RCC->CFGR &= ~3;                            //SW: HSI
+	while(RCC->CFGR & (3 << 2));                //SWS
+	RCC->CR &= ~(1 << 24);                      //PLL off
+	while(RCC->CR & (1 << 25));
+	
+	RCC->CR |= (1 << 16);                       //Activate external clock (HSE)
+	while(!(RCC->CR & (1 << 17)));              //Wait until HSE is ready
+	RCC->PLLCFGR = (1 << 22)                    //PLL source is HSE
+	             | (cp->pllm << 0)
+	             | (cp->plln << 6)
+	             | (((cp->pllp >> 1) - 1) << 16)
+	             | (cp->pllq << 24);
+	RCC->CR |= (1 << 24);                       //Activate PLL
+	while(!(RCC->CR & (1 << 25)));              //Wait until PLL is ready
+	
+	FLASH->ACR = (1 << 10) | (1 << 9) | (1 << 8) | ws; //DCEN, ICEN, PRFTEN, wait states (HSI runs with any)
+	RCC->CFGR = (RCC->CFGR & ~((0x0F << 4) | (7 << 10) | (7 << 13)))
+	          | (hpre[cp->hpre] << 4)
+	          | (ppre[cp->ppre1] << 10)
+	          | (ppre[cp->ppre2] << 13);
+	RCC->CFGR |= 0b10;                          //Switching to PLL clock source
+	while((RCC->CFGR & (3 << 2)) != (2 << 2));
+	
+	clk_hclk = hclk;
+	clk_pclk1 = hclk / cp->ppre1;
+	clk_pclk2 = hclk / cp->ppre2;
+	clk_cur = prof;
+	clk_peripherals();
+	return 1;
+}	
+
+//Timings derived from bus clocks
+void clk_peripherals(void)
+{
+	SysTick->LOAD = (clk_hclk / 1000) - 1;      //1ms
+	
+	SPI1->CR1 &= ~(1 << 6);                     //LCD SPI
+	SPI1->CR1 = (SPI1->CR1 & ~(7 << 3)) | (clk_spi_br(clk_pclk2, LCD_SPI_MAX) << 3);
+	SPI2->CR1 &= ~(1 << 6);                     //DDS SPI
+	SPI2->CR1 = (SPI2->CR1 & ~(7 << 3)) | (clk_spi_br(clk_pclk1, DDS_SPI_MAX) << 3);
+	if(RCC->APB2ENR & (1 << 12))
+	{
+		SPI1->CR1 |= (1 << 6);
+	}	
+	if(RCC->APB1ENR & (1 << 14))
+	{
+		SPI2->CR1 |= (1 << 6);
+	}	
+	
+	ADC1_COMMON->CCR = (ADC1_COMMON->CCR & ~(3 << 16)) | (ADC_PRE << 16);
+	USART1->BRR = (clk_pclk2 + CAT_BAUD / 2) / CAT_BAUD;
+	if(RCC->APB1ENR & RCC_APB1ENR_I2C1EN)
+	{
+		i2c_timing();
+	}	
+}	
+
+/////////////////////////////
+ //  Time base              //
+/////////////////////////////
+//SysTick counts ms, DWT cycle counter is used for short delays.
+//Both derive from clk_hclk, set by clk_apply().
+void time_init(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk; //Enable DWT
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	
+	SysTick->LOAD = (clk_hclk / 1000) - 1;  //1ms
+	SysTick->VAL = 0;
+	SysTick->CTRL = (1 << 2)            //CLKSOURCE: HCLK
+	              | (1 << 1)            //TICKINT
+	              | (1 << 0);           //ENABLE
+	NVIC_SetPriority(SysTick_IRQn, 2);  //Priority level 2
+}	
+
+unsigned long millis(void)
+{
+	return ms_ticks;
+}
+
+//Microseconds since start (wraps after 71 minutes)
+unsigned long micros(void)
+{
+	unsigned long ms, val;
+	
+	do
+	{
+		ms = ms_ticks;
+		val = SysTick->VAL;
+	} while(ms != ms_ticks); //SysTick wrapped while reading
+	
+	return ms * 1000 + ((clk_hclk / 1000) - 1 - val) / (clk_hclk / 1000000);
+}
+	
+void delay_us(unsigned long us)
+{
+	unsigned long c0 = DWT->CYCCNT;
+	unsigned long cycles = (unsigned long long) us * clk_hclk / 1000000;
+	
+	while(DWT->CYCCNT - c0 < cycles);
+}	
+
+void delay_ms(unsigned long ms)
+{
+	unsigned long d = deadline(ms);
+	
+	while(!expired(d));
+}	
+
+//Deadline ms from now, check with expired()
+unsigned long deadline(unsigned long ms)
+{
+	return ms_ticks + ms;
+}
+
+int expired(unsigned long d)
+{
+	return (long) (ms_ticks - d) >= 0;
+}	
+
+  /////////////////////////////
+ //   ISR <-> MAIN HANDOFF  //
+/////////////////////////////
+//Cortex-M4 is single core and in order: STREX fails if an interrupt
+//came between LDREX and STREX (exception entry clears the monitor), so
+//the loops retry instead of disabling interrupts. __DMB also keeps the
+//compiler from moving buffer accesses across index updates.
+
+//Add v, returns new value
+uint32_t atomic_add(volatile uint32_t *a, int32_t v)
+{
+	uint32_t n;
+	
+	do
+	{
+		n = __LDREXW(a) + v;
+	} while(__STREXW(n, a));
+	return n;
 }
 
+//Store v, returns old value
+uint32_t atomic_xchg(volatile uint32_t *a, uint32_t v)
+{
+	uint32_t o;
+	
+	do
+	{
+		o = __LDREXW(a);
+	} while(__STREXW(v, a));
+	return o;
+}	
+
+//Producer side, returns 0 if full (item dropped)
+int spsc_put(struct spsc *q, uint8_t v)
+{
+	uint32_t h = q->head;
+	
+	if(h - q->tail > q->mask)
+	{
+		return 0;
+	}
+	q->buf[h & q->mask] = v;
+	__DMB();                           //Item visible before head
+	q->head = h + 1;
+	return 1;
+}		
+
+//Consumer side, -1 if empty
+int spsc_get(struct spsc *q)
+{
+	uint32_t t = q->tail;
+	int v;
+	
+	if(t == q->head)
+	{
+		return -1;
+	}
+	__DMB();                           //Read item after head
+	v = q->buf[t & q->mask];
+	__DMB();                           //Item read before slot is released
+	q->tail = t + 1;
+	return v;
+}	
+
   /////////////////////////////
  //     INT Handlers        //
 /////////////////////////////
@@ -418,19 +926,16 @@ extern "C" void EXTI0_IRQHandler(void)
     // Check if the interrupt came from exti0
     if (EXTI->PR & (1 << 0))
     {   
-		GPIOC->ODR ^= (1 << 13); //Toggle LED
         state = GPIOB->IDR & 0x03; //Read pins
         if(state & 1)
         {
             if(state & 2)
             {
-                tuning = 1;
-                pulses++;
+                enc_count++;
             }
             else
             {
-                tuning = -1;
-                pulses++;
+                enc_count--;
             }
         }
 
@@ -439,34 +944,157 @@ extern "C" void EXTI0_IRQHandler(void)
     }
 }
 
-//TIM2
-extern "C" void TIM2_IRQHandler(void)
-{	
-	if(TIM2->SR & TIM_SR_UIF)       
+//SysTick: 1ms time base
+extern "C" void SysTick_Handler(void)
+{
+	static int t10 = 0;
+	
+	ms_ticks++;
+	if(++t10 >= 10)
+	{
+		t10 = 0;
+		if(key_awake)
+		{
+			key_scan();
+		}
+		enc_scan();
+	}	
+}
+	
+
+//ADC analog watchdog: key ladder left idle level, key scan on until release
+extern "C" void ADC_IRQHandler(void)
+{
+	if(ADC1->SR & (1 << 0))                //AWD
+	{
+		ADC1->CR1 &= ~(1 << 6);            //AWDIE off, flag is set on every conversion while pressed
+		ADC1->SR = ~(1 << 0);              //rc_w0
+		key_awake = 1;
+	}
+}		
+
+//DMA1 Stream4: SPI2 TX (DDS tuning word)
+extern "C" void DMA1_Stream4_IRQHandler(void)
+{
+	if(DMA1->HISR & ((1 << 5) | (1 << 3))) //Transfer complete or transfer error
     {
-		pulses = 0;
-		runsecs++;
-    }
-    TIM2->SR = 0x00;  //Reset status register  
+		while(!(SPI2->SR & (1 << 1)));      //TXE: last byte moved to shift register
+		while(SPI2->SR & (1 << 7));         //BSY clear: last byte clocked out, < 1us
+		DDS_GPIO->BSRR = (1 << DDS_IO_UD);  //IO_UD hi: apply new FTW
+		dds_busy = 0;
+	}	
+	DMA1->HIFCR = (0x3D << 0);  //Clear all flags of stream 4
+}
+
+//DMA2 Stream3: SPI1 TX (LCD pixel data) 
+extern "C" void DMA2_Stream3_IRQHandler(void)
+{
+	if(DMA2->LISR & ((1 << 27) | (1 << 25))) //Transfer complete or transfer error
+    {
+		lcd_dma_busy = 0;
+	}	
+	DMA2->LIFCR = (0x3D << 22);  //Clear all flags of stream 3
 }
 
   ///////////////////////
  //       L C D       //
 ///////////////////////    
 //Perform hardware reset to LCD
+//Hardware reset pulse, returns at once: lcd_init() waits for the rest
+//of LCD_RST_WAIT, so boot does other work meanwhile
 void lcd_reset(void)
 {
-	LCD_GPIO->ODR |= (1 << RST);  
-	delay(100);
 	LCD_GPIO->ODR &= ~((1 << RST));  
-	delay(100);
+	delay_us(LCD_RST_PULSE);
 	LCD_GPIO->ODR |= (1 << RST);  
-	delay(100);
+	lcd_ready = deadline(LCD_RST_WAIT);
 }	
 
+#ifdef LCD_HW_SPI
+//Send one byte via SPI1 in 8-bit mode, dc=0: command, dc=1: data
+static void lcd_spi_byte(int dc, int value)
+{
+	lcd_wait();
+	
+	if(dc)
+	{
+		LCD_GPIO->BSRR = (1 << DC_AO);          //Data
+	}
+	else
+	{	
+		LCD_GPIO->BSRR = (1 << (DC_AO + 16));   //Command
+	}
+	*(volatile uint8_t*) &SPI1->DR = value;
+}
+
+//Start DMA transfer of n 16-bit pixels, minc=0: repeat one value
+static void lcd_dma_start(const uint16_t *src, int n, int minc)
+{
+	lcd_wait();
+	
+	LCD_GPIO->BSRR = (1 << DC_AO);              //Data
+	SPI1->CR1 &= ~(1 << 6);                     //SPE off
+	SPI1->CR1 |= (1 << 11);                     //DFF: 16-bit frames, MSB first = RGB565 byte order
+	SPI1->CR1 |= (1 << 6);                      //SPE on
+	
+	DMA2_Stream3->CR &= ~(1 << 0);              //Stream off
+	while(DMA2_Stream3->CR & (1 << 0));
+	DMA2->LIFCR = (0x3D << 22);                 //Clear all flags of stream 3
+	DMA2_Stream3->PAR = (uint32_t) &SPI1->DR;
+	DMA2_Stream3->M0AR = (uint32_t) src;
+	DMA2_Stream3->NDTR = n;
+	DMA2_Stream3->CR = (3 << 25)                //Channel 3: SPI1_TX
+	                 | (1 << 13)                //MSIZE 16 bit
+	                 | (1 << 11)                //PSIZE 16 bit
+	                 | (minc << 10)             //Memory increment
+	                 | (1 << 6)                 //Memory to peripheral
+	                 | (1 << 4)                 //Transfer complete interrupt
+	                 | (1 << 2);                //Transfer error interrupt
+	lcd_dma_busy = 1;
+	DMA2_Stream3->CR |= (1 << 0);               //Stream on
+	SPI1->CR2 |= (1 << 1);                      //TXDMAEN
+}
+#endif
+
+//Wait until DMA and SPI are idle and SPI is back in 8-bit mode
+void lcd_wait(void)
+{
+#ifdef LCD_HW_SPI
+	while(lcd_dma_busy)
+	{
+		if(lcd_idle_hook)
+		{
+			lcd_idle_hook();                    //e.g. keep tuning while pixels are sent
+		}
+	}		
+	while(!(SPI1->SR & (1 << 1)));              //TXE
+	while(SPI1->SR & (1 << 7));                 //BSY
+	
+	if(SPI1->CR1 & (1 << 11))
+	{
+		SPI1->CR2 &= ~(1 << 1);                 //TXDMAEN off
+		SPI1->CR1 &= ~(1 << 6);                 //SPE off
+		SPI1->CR1 &= ~(1 << 11);                //DFF: 8-bit frames
+		SPI1->CR1 |= (1 << 6);                  //SPE on
+	}
+#endif
+}		
+
 //Write command to LCD
 void lcd_write_command(int cmd)
 {
+#ifdef LCD_FRAMEBUFFER
+	if(lcd_fb_on && (cmd == ST7735_RAMWR)) //Start of window in RAM
+	{
+		lcd_fb_cx = lcd_fb_wx0;
+		lcd_fb_cy = lcd_fb_wy0;
+		return;
+	}
+#endif
+	IO_COUNT(lcd, 1);
+#ifdef LCD_HW_SPI
+	lcd_spi_byte(0, cmd);
+#else
 	int t1;
 	
 	LCD_GPIO->ODR &= ~(1 << DC_AO);  //Command
@@ -484,11 +1112,16 @@ void lcd_write_command(int cmd)
 	    }
 	    LCD_GPIO->ODR |= (1 << CLK);  //SCL=1		
 	}	
+#endif
 }	
 
-//Write data to LCD
+//Write data to LCD, also used per byte by the GPIO pixel paths
 void lcd_write_data(int dvalue)
 {
+	IO_COUNT(lcd, 1);
+#ifdef LCD_HW_SPI
+	lcd_spi_byte(1, dvalue);
+#else
 	int t1;
 	
 	LCD_GPIO->ODR |= (1 << DC_AO);     //Data
@@ -505,27 +1138,204 @@ void lcd_write_data(int dvalue)
 	    }
 	    LCD_GPIO->ODR |= (1 << CLK);  //SCL=1		
 	}	
+#endif
+}	
+
+#ifdef LCD_FRAMEBUFFER
+//Write n pixels (from src or of color if src is 0) to framebuffer at
+//write position, wrapping inside window like the controller does
+static void lcd_fb_write(const uint16_t *src, unsigned int color, int n)
+{
+	uint16_t *dst;
+	int t1, len;
+	
+	while(n > 0)
+	{
+		len = lcd_fb_wx1 - lcd_fb_cx + 1;  //Rest of row in window
+		if(len > n)
+		{
+			len = n;
+		}
+		
+		dst = &lcd_fb[lcd_fb_cy * LCD_FB_W + lcd_fb_cx];
+		if(src)
+		{
+			for(t1 = 0; t1 < len; t1++)
+			{
+				dst[t1] = *src++;
+			}
+		}
+		else
+		{			
+			for(t1 = 0; t1 < len; t1++)
+			{
+				dst[t1] = color;
+			}
+		}
+				
+		if(lcd_fb_cx < lcd_fb_dx0[lcd_fb_cy])
+		{
+			lcd_fb_dx0[lcd_fb_cy] = lcd_fb_cx;
+		}
+		if(lcd_fb_cx + len - 1 > lcd_fb_dx1[lcd_fb_cy])
+		{
+			lcd_fb_dx1[lcd_fb_cy] = lcd_fb_cx + len - 1;
+		}
+		
+		n -= len;
+		lcd_fb_cx += len;
+		if(lcd_fb_cx > lcd_fb_wx1)
+		{
+			lcd_fb_cx = lcd_fb_wx0;
+			if(++lcd_fb_cy > lcd_fb_wy1)
+			{
+				lcd_fb_cy = lcd_fb_wy0;
+			}
+		}
+	}
+}	
+
+//From now on drawing goes to framebuffer (after lcd_init())
+void lcd_fb_begin(void)
+{
+	int t1;
+	
+	for(t1 = 0; t1 < LCD_FB_H; t1++)
+	{
+		lcd_fb_dx0[t1] = 0xFF;
+		lcd_fb_dx1[t1] = 0;
+	}
+	lcd_fb_on = 1;
+}	
+
+//If panel is idle: send first run of changed rows as one rectangle
+void lcd_fb_flush(void)
+{
+	int x0 = LCD_FB_W, x1 = 0, y0, y1, x, y, w;
+	uint16_t *dst = lcd_fb_tx;
+	
+	if(lcd_dma_busy)
+	{
+		return;
+	}
+	
+	for(y0 = 0; y0 < LCD_FB_H && lcd_fb_dx0[y0] > lcd_fb_dx1[y0]; y0++);
+	if(y0 == LCD_FB_H)
+	{
+		return; //Nothing changed
+	}
+	for(y1 = y0; y1 < LCD_FB_H && lcd_fb_dx0[y1] <= lcd_fb_dx1[y1]; y1++)
+	{
+		if(lcd_fb_dx0[y1] < x0)
+		{
+			x0 = lcd_fb_dx0[y1];
+		}
+		if(lcd_fb_dx1[y1] > x1)
+		{
+			x1 = lcd_fb_dx1[y1];
+		}
+		lcd_fb_dx0[y1] = 0xFF;
+		lcd_fb_dx1[y1] = 0;
+	}
+	y1--;
+	
+	w = x1 - x0 + 1;
+	for(y = y0; y <= y1; y++)
+	{
+		for(x = 0; x < w; x++)
+		{
+			*dst++ = lcd_fb[y * LCD_FB_W + x0 + x];
+		}
+	}
+	
+	lcd_fb_on = 0;                     //Real panel access
+	lcd_setwindow(x0, y0, x1, y1);
+	lcd_write_command(ST7735_RAMWR);
+	lcd_write_pixels(lcd_fb_tx, w * (y1 - y0 + 1));
+	lcd_fb_on = 1;
 }	
+#endif
+
+//Write n pixels from buffer to LCD RAM (after RAMWR)
+//With LCD_HW_SPI the transfer runs in background, buffer must not
+//be touched before next lcd_wait()
+void lcd_write_pixels(const uint16_t *buf, int n)
+{
+	if(n <= 0)
+	{
+		return;
+	}
+		
+#ifdef LCD_FRAMEBUFFER
+	if(lcd_fb_on)
+	{
+		lcd_fb_write(buf, 0, n);
+		return;
+	}
+#endif
+#ifdef LCD_HW_SPI
+	IO_COUNT(lcd, n * 2);
+	lcd_dma_start(buf, n, 1);
+#else
+	int t1;
+	for(t1 = 0; t1 < n; t1++)
+	{
+		lcd_write_data(buf[t1] >> 8);
+		lcd_write_data(buf[t1]);
+	}
+#endif
+}		
+
+//Write n pixels of one color to LCD RAM (after RAMWR)
+void lcd_fill_pixels(unsigned int color, int n)
+{
+	if(n <= 0)
+	{
+		return;
+	}
+		
+#ifdef LCD_FRAMEBUFFER
+	if(lcd_fb_on)
+	{
+		lcd_fb_write(0, color, n);
+		return;
+	}
+#endif
+#ifdef LCD_HW_SPI
+    lcd_wait();   //Previous fill may still read lcd_fillcolor
+    lcd_fillcolor = color;
+    IO_COUNT(lcd, n * 2);
+	lcd_dma_start(&lcd_fillcolor, n, 0);
+#else
+	int t1;
+	for(t1 = 0; t1 < n; t1++)
+	{
+		lcd_write_data(color >> 8);
+		lcd_write_data(color);
+	}
+#endif
+}		
 
 //Init LCD to vertical alignement and 16-bit color mode
 void lcd_init(void)
 {
+	while(!expired(lcd_ready));        //Controller out of reset
 
 	lcd_write_command(ST7735_SWRESET); // software reset
-	delay(5);
+	delay_ms(5);
 
 	lcd_write_command(ST7735_SLPOUT);  // out of sleep mode
-	delay(5);
+	delay_ms(5);
 
 	lcd_write_command(ST7735_COLMOD);  // set color mode
 	lcd_write_data(0x05);              // 16-bit color
-	delay(10);
+	delay_ms(10);
 
 	lcd_write_command(ST7735_FRMCTR1); // frame rate control
 	lcd_write_data(0x00);              // fastest refresh
 	lcd_write_data(0x06);              // 6 lines front porch
 	lcd_write_data(0x03);              // 3 lines backporch
-	delay(1);
+	delay_ms(1);
 
 	lcd_write_command(ST7735_MADCTL);  // memory access control (directions)
 	lcd_write_data(0xC8);              // row address/col address, bottom to top refresh
@@ -572,10 +1382,10 @@ void lcd_init(void)
 	lcd_write_data(0x06);
 	lcd_write_data(0x02);
 	lcd_write_data(0x0F);
-	delay(10);
+	delay_ms(10);
 	
 	lcd_write_command(ST7735_NORON);   // Normal display on
-	delay(10);
+	delay_ms(10);
 
 	lcd_write_command(ST7735_DISPON);  //Display ON
 }	
@@ -583,6 +1393,16 @@ void lcd_init(void)
 //Define window area for next graphic operation
 void lcd_setwindow(int x0, int y0, int x1, int y1)
 {
+#ifdef LCD_FRAMEBUFFER
+	if(lcd_fb_on)
+	{
+		lcd_fb_wx0 = (x0 < LCD_FB_W) ? x0 : LCD_FB_W - 1;
+		lcd_fb_wx1 = (x1 < LCD_FB_W) ? x1 : LCD_FB_W - 1;
+		lcd_fb_wy0 = (y0 < LCD_FB_H) ? y0 : LCD_FB_H - 1;
+		lcd_fb_wy1 = (y1 < LCD_FB_H) ? y1 : LCD_FB_H - 1;
+		return;
+	}
+#endif
 	lcd_write_command(ST7735_CASET);   //Coloumn address set
 	lcd_write_data(0x00);
 	lcd_write_data(x0);          
@@ -596,190 +1416,14 @@ void lcd_setwindow(int x0, int y0, int x1, int y1)
 	lcd_write_data(y1);        
 }
 
-//Set a pixel (Not used, just for academic purposes!)
-void lcd_setpixel(int x, int y, unsigned int color)
+//STRLEN
+int strlen(char *s)
 {
-	lcd_setwindow(x, y, x, y);
-	lcd_write_command(ST7735_RAMWR);		// RAM access set
-	lcd_write_data(color >> 8);
-	lcd_write_data(color);
-}
-
-//Clear full LCD with background color
-void lcd_cls0(unsigned int bgcolor)
-{
-	int t1;
-	lcd_setwindow(0, 0, 132, 132);
-	lcd_write_command(ST7735_RAMWR);		// RAM access set
-		
-    for(t1 = 0; t1 <= 17424; t1++)
-    {
-		lcd_write_data(bgcolor >> 8);
-	    lcd_write_data(bgcolor);
-	}    
-}	
-
-//Clear part of LCD with background color
-void lcd_cls1(int x0, int y0, int x1, int y1, unsigned int bgcolor)
-{
-	int t1, sz = (x1 - x0) * (y1 - y0);
-	lcd_setwindow(x0, y0, x1, y1);
-	lcd_write_command(ST7735_RAMWR);		// RAM access set
-		
-    for(t1 = 0; t1 <= sz; t1++)
-    {
-		lcd_write_data(bgcolor >> 8);
-	    lcd_write_data(bgcolor);
-	}    
-}	
-
-//Print one character to given coordinates to the screen
-//sx and sy define "stretch factor"
-void lcd_putchar(int x0, int y0, unsigned char ch0, unsigned int fcol, unsigned int bcol, int sx, int sy)
-{
-	int x, y, t1, t2;
-	unsigned char ch;
-	
-    lcd_setwindow(x0 + 2, y0 + 2, x0 + FONTWIDTH * sx + 1, y0 + FONTHEIGHT * sy);
-	lcd_write_command(ST7735_RAMWR);
-	
-	for(y = 0; y < FONTHEIGHT - 1; y++)
-	{
-		ch = xchar[ch0 - CHAROFFSET][y]; 
-	    for(t1 = 0; t1 < sy; t1++)
-	    {
-	        for(x = 0; x < FONTWIDTH; x++)
-	        {
-		        if((1 << x) & ch)
-		        {
-					for(t2 = 0; t2 < sx; t2++)
-					{
-			            lcd_write_data(fcol >> 8);
-			            lcd_write_data(fcol);
-			        }    
-			    }
-	   	        else	
-		        {
-					for(t2 = 0; t2 < sx; t2++)
-					{
-			            lcd_write_data(bcol >> 8);
-			            lcd_write_data(bcol);
-			        }    
-			    }   
-		    }
-	    }	
-	}
-}	
-
-//Print one \0 terminated string to given coordinates to the screen
-//xf and yf define "stretch factor"
-void lcd_putstring(int x0, int y0, char *s, unsigned int fcol, unsigned int bcol, int xf, int yf)
-{
-	int x = 0;
-	
-	while(*s)
-	{
-		lcd_putchar(x + x0, y0, *(s++), fcol, bcol, xf, yf);
-		x += (FONTWIDTH * xf);
-	}	
-}
-
-
-//Print a number
-//xf and yf define "stretch factor"
-int lcd_putnumber(int col, int row, long num, int dec, int fcolor, int bcolor, int xf, int yf)
-{
-    char *s = (char*) malloc(16);
-    int slen = 0;
-	if(s != NULL)
-	{
-	    int2asc(num, dec, s, 16);
-	    lcd_putstring(col, row, s, fcolor, bcolor, xf, yf);
-	    slen = strlen(s);
-	    free(s);
-	}	
-	return slen;
-}
-
-//////////////////////
-// STRING FUNCTIONS //
-//////////////////////
-//INT 2 ASC: Put a number to the screen (with decimal separator if needed)
-int int2asc(long num, int dec, char *buf, int buflen)
-{
-    int i, c, xp = 0, neg = 0;
-    long n, dd = 1E09;
-
-    if(!num)
-	{
-	    *buf++ = '0';
-		*buf = 0;
-		return 1;
-	}	
-		
-    if(num < 0)
-    {
-     	neg = 1;
-	    n = num * -1;
-    }
-    else
-    {
-	    n = num;
-    }
-
-    //Fill buffer with \0
-    for(i = 0; i < buflen; i++)
-    {
-	    *(buf + i) = 0;
-    }
-
-    c = 9; //Max. number of displayable digits
-    while(dd)
-    {
-	    i = n / dd;
-	    n = n - i * dd;
-	
-	    *(buf + 9 - c + xp) = i + 48;
-	    dd /= 10;
-	    if(c == dec && dec)
-	    {
-	        *(buf + 9 - c + ++xp) = '.';
-	    }
-	    c--;
-    }
-
-    //Search for 1st char different from '0'
-    i = 0;
-    while(*(buf + i) == 48)
-    {
-	    *(buf + i++) = 32;
-    }
-
-    //Add minus-sign if neccessary
-    if(neg)
-    {
-	    *(buf + --i) = '-';
-    }
-
-    //Eleminate leading spaces
-    c = 0;
-    while(*(buf + i))
-    {
-	    *(buf + c++) = *(buf + i++);
-    }
-    *(buf + c) = 0;
-	
-	return c;
-}
-
-//STRLEN
-int strlen(char *s)
-{
-   int t1 = 0;
-
-   while(*(s + t1++));
-
-   return (t1 - 1);
+   int t1 = 0;
+
+   while(*(s + t1++));
+
+   return (t1 - 1);
 }
 
 //////////////////////////////////
@@ -788,13 +1432,54 @@ int strlen(char *s)
 //
 //////////////////////////////////
 //FREQUENCY
-void show_frequency1(long f, int csize)
+//Double size readout is a right aligned field of FREQ_DIGITS chars,
+//only chars that differ from freq_shown[] are redrawn
+void draw_frequency1(long f, int csize)
 {
+	PROF_BEGIN();
 	int x;
 	int y = calc_ypos(3);
 	int fcolor;
+	int t1, len = 0, ofs;
+	char s[16], ch;
 
     fcolor = WHITE;
+    
+    if(csize == 2)
+    {
+		x = 128 - FONTWIDTH * 2 * FREQ_DIGITS - 5;
+		if(f)
+		{
+			len = freq2asc(f, s, 16);
+		}
+		ofs = len - FREQ_DIGITS; //< 0: leading blanks (f < 10MHz)
+		
+		for(t1 = 0; t1 < FREQ_DIGITS; t1++)
+		{
+			if(t1 + ofs >= 0)
+			{
+				ch = s[t1 + ofs];
+			}
+			else
+			{
+				ch = ' ';
+			}		
+			
+			if(ch != freq_shown[t1])
+			{
+				lcd_putchar(x + t1 * FONTWIDTH * 2, y, ch, fcolor, backcolor, 2, 2);
+				freq_shown[t1] = ch;
+			}
+		}
+		PROF_END(PRF_FREQ);
+		return;		
+	}
+	
+	//Other sizes: full redraw, field contents unknown afterwards
+	for(t1 = 0; t1 < FREQ_DIGITS; t1++)
+	{
+		freq_shown[t1] = 0;
+	}	
 	
 	if(f < 10000000)
 	{
@@ -819,12 +1504,12 @@ void show_frequency1(long f, int csize)
 		{
 		    lcd_putnumber(x, y, f / 100, 1, fcolor, backcolor, csize, csize);
 		}
-	}	    
-
+	}
+	PROF_END(PRF_FREQ);
 }
 
 //(alternative) FREQUENCY SMALL
-void show_frequency2(long f)
+void draw_frequency2(long f)
 {
 	int xpos, ypos = calc_ypos(2);
 	
@@ -842,7 +1527,7 @@ void show_frequency2(long f)
 }
 
 //BAND
-void show_band(int band, int invert)
+void draw_band(int band, int invert)
 {
 	char *band_str[MAXBANDS] = {(char*)"160m", (char*)"80m ", (char*)"40m ", (char*)"20m ", (char*)"17m ", (char*)"15m ", (char*)"12m ", (char*)"10m "};
 	int xpos = calc_xpos(0), ypos = calc_ypos(0);	  
@@ -879,7 +1564,7 @@ void show_band(int band, int invert)
 }
 
 //SIDEBAND
-void show_sideband(int sb, int invert)
+void draw_sideband(int sb, int invert)
 {
 	int xpos = calc_xpos(7), ypos = calc_ypos(0);
 	int forecolor;
@@ -908,7 +1593,7 @@ void show_sideband(int sb, int invert)
 }
 
 //VFO
-void show_vfo(int cvfo, int cband, int invert)
+void draw_vfo(int cvfo, int invert)
 {
 	int xpos = calc_xpos(12), ypos = calc_ypos(0);
 	int forecolor;
@@ -922,16 +1607,6 @@ void show_vfo(int cvfo, int cband, int invert)
 	{
 		forecolor = YELLOW;
 	}	
-	//Show frequency of other VFO in d
-	if(!cvfo)	
-	{
-		show_frequency2(f_vfo[cband][1]);
-	}
-	else	
-	{
-		show_frequency2(f_vfo[cband][0]);
-	}
-	
 	//Write string to position
 	if(!invert)
 	{
@@ -944,60 +1619,52 @@ void show_vfo(int cvfo, int cband, int invert)
 }
 
 //VDD
-void show_voltage(int v1)
+void draw_voltage(int v1)
 {
-    char *buffer;
-	int t1, p;
+    char buffer[0x10];
+	int p;
 	int xpos = calc_xpos(0), ypos = calc_ypos(1);
 	int fcolor;
 		
-	buffer= (char*)malloc(0x10);
-	//Init buffer string
-	for(t1 = 0; t1 < 0x10; t1++)
-	{
-	    *(buffer + t1) = 0;
-	}
-    
     p = int2asc(v1, 1, buffer, 6) * FONTWIDTH + xpos;
     
-    if(v1 < 10)
+    if(v1 < 100) //v1 in 0.1V
     {
 		fcolor = RED;
 	}
 	
-	if(v1 >= 10 && v1 < 11)
+	if(v1 >= 100 && v1 < 110)
     {
 		fcolor = LIGHTRED;
 	}	
 	
-	if(v1 >= 11 && v1 < 13)
+	if(v1 >= 110 && v1 < 130)
     {
 		fcolor = GREEN;
 	}	
 	
-	if(v1 >= 13)
+	if(v1 >= 130)
     {
 		fcolor = LIGHTGREEN;
 	}	
 	
     lcd_putstring(xpos, ypos, buffer, fcolor, backcolor, 1, 1);
 	lcd_putstring(p, ypos, (char*)"V ", fcolor, backcolor, 1, 1);
-	free(buffer);
 }
 
 //PA TEMP
-void show_pa_temp(int tmp)
+void draw_pa_temp(int tmp)
 {
 	int xpos = calc_xpos(12);
 	int ypos = calc_ypos(1);
 	int fcolor = LIGHTGREEN;
 	
-	if(tmp > 40)
+	if(tmp > TEL_PA_WARN)
 	{
 		fcolor = LIGHTYELLOW;
 	}	
 	
-	if(tmp > 60)
+	if(tmp >= TEL_PA_ALERT)
 	{
 		fcolor = LIGHTRED;
 	}	
@@ -1008,69 +1675,19 @@ void show_pa_temp(int tmp)
 	lcd_putchar(xpos, ypos, 'C', fcolor, backcolor, 1, 1); //C
 }
 
-//Message
-void show_msg(char *msg, int fcolor)
+//Message, num >= 0 is appended in yellow
+void draw_msg(char *msg, int fcolor, int num)
 {	
 	int xpos = calc_xpos(0), ypos = calc_ypos(6);
 	lcd_putstring(xpos, ypos, (char*)"                ", fcolor, backcolor, 1, 1);
 	lcd_putstring(xpos, ypos, msg, fcolor, backcolor, 1, 1);
-}	
-
-
-//Meter
-void show_meter(int sv0)
-{
-    int sv = sv0;
-    
-    if(sv > 120)
-    {
-		sv = 120;
-	}	
-				    
-	//Clear bar graph
-	draw_meter_bar(sv, smax, backcolor);
-	
-	//Draw new bar graph in different colors
-	if(sv < 50)
-	{
-	    draw_meter_bar(0, sv, GREEN);
-	}
-	if(sv >= 65 && sv < 89)
-	{
-	    draw_meter_bar(0, 65, GREEN);
-	    draw_meter_bar(66, sv, LIGHTYELLOW);
-	}
-
-	if(sv >= 89)
+	if(num >= 0)
 	{
-	    draw_meter_bar(0, 65, GREEN);
-	    draw_meter_bar(66, 89, LIGHTYELLOW);
-	    draw_meter_bar(89, sv, LIGHTRED);
-	}
-    
-	if(sv > smax)
-	{
-		smax = sv;
-		runsecs_smax = runsecs;
+		lcd_putnumber(calc_xpos(strlen(msg)), ypos, num, -1, YELLOW, backcolor, 1, 1);
 	}	
-	
-	sv_old = sv;   
-}
-
-//S-Meter bargraph 
-void draw_meter_bar(int x0, int x1, int fcol)
-{
-	int t1;
-	
-	lcd_setwindow(x0 + 2, METERY, x1 + 2, 94);
-	lcd_write_command(ST7735_RAMWR);
-	for(t1 = 0; t1 < ((x1 - x0) << 2) + 4; t1++)
-	{
-		lcd_write_data(fcol >> 8);
-	    lcd_write_data(fcol);
-	}
 }	
 
+
 //Scale for meter
 void draw_meter_scale(int meter_type)
 {
@@ -1089,10 +1706,10 @@ void draw_meter_scale(int meter_type)
 }
 
 //TX/RX status
-void show_txrx(void)
+void draw_txrx(int rx)
 {
 	int xpos = calc_xpos(7), ypos = calc_ypos(1);
-	if(!get_txrx())
+	if(!rx)
 	{
 		lcd_putstring(xpos, ypos, (char*)"TX", BLACK, LIGHTRED, 1, 1);
 	}
@@ -1102,6 +1719,45 @@ void show_txrx(void)
 	}
 }	
 
+//Clear screen and draw frame of main screen
+void draw_screen(void)
+{
+	int t1;
+	
+    lcd_cls0(backcolor);
+    for(t1 = 0; t1 < FREQ_DIGITS; t1++)
+	{
+		freq_shown[t1] = 0; //Digits have to be redrawn
+	}	
+	sv_old = 0;             //Meter bar empty
+	smax_shown = -1;
+        
+    lcd_hline(0, calc_ypos(0) + FONTHEIGHT + 3, 129, LIGHTBLUE);
+    lcd_hline(0, calc_ypos(1) + FONTHEIGHT + 3, 129, LIGHTBLUE);
+    lcd_vline(50, 0, calc_ypos(1) + FONTHEIGHT + 3, LIGHTBLUE);
+    lcd_vline(90, 0, calc_ypos(1) + FONTHEIGHT + 3, LIGHTBLUE);
+    lcd_hline(0, calc_ypos(4) + FONTHEIGHT - 2, 129, LIGHTBLUE);
+    lcd_hline(0, calc_ypos(5) + FONTHEIGHT + 3, 129, LIGHTBLUE);
+    lcd_hline(0, calc_ypos(6) + FONTHEIGHT + 3, 129, LIGHTBLUE);
+}
+
+//Main screen with all values, after a full screen page
+void redraw_screen(void)
+{
+	draw_screen();
+	show_band(cur_band, 0);
+	show_sideband(sideband, 0);
+	show_vfo(cur_vfo, cur_band, 0);
+	show_frequency1(f_vfo[cur_band][cur_vfo], 2);
+	show_voltage(get_vdd());
+	show_pa_temp(get_pa_temp());
+	draw_meter_scale(0);
+	smax_shown = -1;                           //Peak marker is gone with the screen
+	rq_post(RQ_METER, (sv_filt + 8) >> 4, smax, 0, 0); //Bar and marker as last posted
+	show_txrx();
+	show_msg((char*)"DK7IH 8-Band-TRX", LIGHTBLUE);    
+}
+
 //Get X and Y position for row and coloumn in text mode
 int calc_xpos(int col)
 {
@@ -1113,170 +1769,456 @@ int calc_ypos(int row)
 	return row * (FONTHEIGHT + 5) + 5;
 }	
 
-//LINES
-void draw_hor_line(int x0, int x1, int y, int color)
+
+  ///////////////////////
+ //  RENDER QUEUE     //     
+///////////////////////
+//show_xxx() functions only post the region and its content,
+//render_poll() draws one queued region per call
+void rq_post(int region, long val, int arg, int flags, const char *txt)
 {
-	int t1;
-    for(t1 = x0; t1 < x1; t1++)
+	int t1 = 0;
+	struct render_job *j = &rq_job[region];
+	
+	j->val = val;
+	j->arg = arg;
+	if(txt)
 	{
-		lcd_setpixel(t1, y, color);
+		while(txt[t1] && t1 < 16)
+		{
+			j->txt[t1] = txt[t1];
+			t1++;
+		}	
 	}
-}
-void draw_vert_line(int x, int y0, int y1, int color)
-{
-	int t1;
-    for(t1 = y0; t1 < y1; t1++)
+	j->txt[t1] = 0;
+			
+	if(rq_pending & (1 << region))
 	{
-		lcd_setpixel(x, t1, color);
+		j->flags |= flags;  //Coalesce: keep pending clear request
+		return;
 	}
+	
+	j->flags = flags;
+	rq_fifo[(rq_head + rq_cnt) % RQ_REGIONS] = region;
+	rq_cnt++;
+	rq_pending |= (1 << region);
 }
 
-///////////////////////
-//    A   D   C      //     
-///////////////////////
-//Read ADC value
-int get_adc(int adc_channel)
+//Draw next region from queue, returns number of regions still pending
+int render_poll(void)
 {
-	int adc_val = 0;
-	ADC1->SQR3 &= ~(0x3FFFFFFF);
+	struct render_job j;
+	int region;
 	
-	switch(adc_channel)
+#ifdef LCD_FRAMEBUFFER
+	lcd_fb_flush();                    //Previous frame to panel while this one is drawn
+#endif
+	if(!rq_cnt)
 	{
-		case KEYS:  ADC1->SQR3 |= (4 << 0);	//Connect to ADC channel 4 (PA4)
-		            break;
-		case VDD:   ADC1->SQR3 |= (5 << 0);	//Connect to ADC channel 5 (PA5)
-		            break;  
-		case MTR:   ADC1->SQR3 |= (6 << 0);	//Connect to ADC channel 6 (PA6)
-		            break;              
-		case TMP:   ADC1->SQR3 |= (7 << 0);	//Connect to ADC channel 7 (PA7)
-		            break;                          
+		return 0;
 	}
 	
-    ADC1->CR2 |= (1 << 30);         //Start conversion SWSTART bit 
-    while(!(ADC1->SR & (1 << 1)));  //Wait until conversion is complete
-    adc_val = ADC1->DR;             //Read value from reg	           
-			
-	return adc_val;
-}	
+	region = rq_fifo[rq_head];
+	rq_head = (rq_head + 1) % RQ_REGIONS;
+	rq_cnt--;
+	rq_pending &= ~(1 << region);
+	j = rq_job[region]; //Copy, slot may be re-posted while drawing
+	
+	switch(region)
+	{
+		case RQ_FREQ1:    if(j.flags & RQ_CLEAR)
+		                  {
+							  draw_frequency1(0, j.arg);
+						  }
+						  if(j.val)
+						  {	  
+		                      draw_frequency1(j.val, j.arg);
+		                  }    
+		                  break;
+		case RQ_FREQ2:    draw_frequency2(j.val);
+		                  break;
+		case RQ_BAND:     draw_band(j.val, j.arg);
+		                  break;
+		case RQ_SIDEBAND: draw_sideband(j.val, j.arg);
+		                  break;
+		case RQ_VFO:      draw_vfo(j.val, j.arg);
+		                  break;
+		case RQ_VOLTAGE:  draw_voltage(j.val);
+		                  break;
+		case RQ_PATEMP:   draw_pa_temp(j.val);
+		                  break;
+		case RQ_MSG:      draw_msg(j.txt, j.arg, j.val);
+		                  break;
+		case RQ_METER:    {
+			                  PROF_BEGIN();
+			                  draw_meter(j.val, j.arg);
+			                  PROF_END(PRF_METER);
+		                  }
+		                  break;
+		case RQ_TXRX:     draw_txrx(j.val);
+		                  break;
+	}
+	
+	return rq_cnt;
+}
 
-//Read keys on ADC channel 5
-int get_keys(void)
+void show_frequency1(long f, int csize)
 {
-
-    int key_value[] = {370, 735, 1320, 2462, 1863, 3135};
-    int t1;
-    int adcval0 = get_adc(1);
-    long adcval1 = 0;
-    int adcvalcnt = 0;
-    long secs0 = runsecs;
-    
-    //lcd_putstring(calc_xpos(0), calc_ypos(3), (char*)"    ", WHITE, backcolor, 1, 1);        
-	//lcd_putnumber(calc_xpos(0), calc_ypos(3), adcval0, -1, YELLOW, backcolor, 1, 1);
-    
-   	if(adcval0 > 4000) //NO key pressed
-   	{
-		return -1;
+	if(!f)
+	{
+		rq_post(RQ_FREQ1, 0, csize, RQ_CLEAR, 0);
 	}
-		
-	while(get_adc(1) <= 4000) //Key pressed
-    {
-		adcval1 += get_adc(1);
-		adcvalcnt++;
-	    lcd_putnumber(calc_xpos(0), calc_ypos(5), runsecs - secs0, -1, YELLOW, backcolor, 1, 1);
-	    //lcd_putstring(calc_xpos(8), calc_ypos(5), (char*)"    ", backcolor, backcolor, 1, 1);        
-	    //lcd_putnumber(calc_xpos(8), calc_ypos(5), get_adc(1), -1, YELLOW, backcolor, 1, 1);
-   	}
-   	
-   	adcval0 = adcval1 / adcvalcnt; //Calc average of adcval
-   		
-    for(t1 = 0; t1 < 6; t1++)
-    {
-		if((adcval0 > (key_value[t1] - 100)) && (adcval0 < (key_value[t1] + 100)))
-		{
-			lcd_putstring(calc_xpos(0), calc_ypos(6), (char*)"KEY:    ", WHITE, backcolor, 1, 1);        
-			runsecs_msg = runsecs;
-			
-			if((runsecs - secs0) < 2)
-            {
-				
-	            lcd_putnumber(calc_xpos(4), calc_ypos(6), t1, -1, YELLOW, backcolor, 1, 1);
-				return t1;
-				
-		    }
-		    else
-		    {
-				lcd_putnumber(calc_xpos(4), calc_ypos(6), t1 + 6, -1, YELLOW, backcolor, 1, 1);
-				return t1 + 6;
-				
-		    }	            
-		}    
-    }
-    
-    return -1;
+	else
+	{	
+	    rq_post(RQ_FREQ1, f, csize, 0, 0);
+	}    
 }
 
-//Measure voltage
-int get_vdd(void)
+void show_frequency2(long f)
 {
-    double v1;
-    v1 = (double) get_adc(VDD) * 0.088623046875; //3.3 / 1024 * 11 / 1 * 10;
-	return (int) v1;	
+	rq_post(RQ_FREQ2, f, 0, 0, 0);
+}
 
+void show_band(int band, int invert)
+{
+	rq_post(RQ_BAND, band, invert, 0, 0);
 }
 
-//Get adc value for S-meter
-int get_sval(void)
+void show_sideband(int sb, int invert)
 {
-    int adcval =  get_adc(MTR) >> 4;
-	return adcval;	
+	rq_post(RQ_SIDEBAND, sb, invert, 0, 0);
 }
 
-//Get adc value for PWR-meter
-int get_txpwr(void)
+//Show VFO and frequency of other VFO
+void show_vfo(int cvfo, int cband, int invert)
 {
-    int adcval =  get_adc(MTR) >> 4;
-	return adcval;	
+	rq_post(RQ_VFO, cvfo, invert, 0, 0);
+	show_frequency2(f_vfo[cband][!cvfo]);
 }
 
-//KTY81-210	analog read
-int get_pa_temp(void)
+void show_voltage(int v1)
 {
-	int adc = get_adc(TMP);
-	double ux = (double) (3.3 * adc) / 4096;
-    double rx = 1000 / (3.3 / ux - 1);  //1k to KTY81-210 voltage divider
-	double temp = (rx - 1630) / 17.62;  //slope and y0 for KTY81-210
-	
-	return (int) temp;
-}	
+	rq_post(RQ_VOLTAGE, v1, 0, 0, 0);
+}
 
-int get_txrx(void)
+void show_pa_temp(int tmp)
 {
-    int pin_input = ~GPIOB->IDR; //"0" means "pressed"!
-	if(pin_input & (1 << 3))
-	{
-        return 1;
-    }	
-    else
-	{
-        return 0;
-    }	    
-}	
+	rq_post(RQ_PATEMP, tmp, 0, 0, 0);
+}
 
-  /////////////////
- //  SPI  DDS   // 
-/////////////////
-void spi_send_byte(unsigned int sbyte)
+void show_msg(char *msg, int fcolor)
 {
-    int t1, x = (1 << 7);
-	
-	for(t1 = 0; t1 < 8; t1++)
+	rq_post(RQ_MSG, -1, fcolor, 0, msg);
+}
+
+void show_key(int key)
+{
+	rq_post(RQ_MSG, key, WHITE, 0, "KEY:");
+}
+
+//Smooth value, track peak and post only if display changes
+void show_meter(int sv)
+{
+	sv = meter_update(sv, millis());
+	if(sv >= 0)
 	{
-	    DDS_GPIO->ODR &= ~(1 << DDS_SCLK);  //DDS_SCLK lo
-    	
-        //Bit set or erase
-	    if(sbyte & x)
-	    {
-		    DDS_GPIO->ODR |= (1 << DDS_SDIO);  
+		rq_post(RQ_METER, sv, smax, 0, 0);
+	}
+}
+
+void show_txrx(void)
+{
+	rq_post(RQ_TXRX, get_txrx(), 0, 0, 0);
+}
+
+///////////////////////
+//    A   D   C      //     
+///////////////////////
+//ADC1 in scan + continuous mode, results via DMA2 stream 0 channel 0
+void adc_init(void)
+{
+	int t1;
+	
+    //Port config
+    for(t1 = 4; t1 < 8; t1++) //PA7:PA4 to analog mode
+    {
+        GPIOA->MODER |= (3 << (t1 << 1));           //Set PAt1 to analog mode
+    }
+        
+    //ADC config sequence
+    RCC->APB2ENR |= (1 << 8);	                    //Enable ADC1 clock (Bit8) 
+    RCC->AHB1ENR |= (1 << 22);                      //DMA2 clock enable
+    ADC1_COMMON->CCR = (ADC1_COMMON->CCR & ~(3 << 16)) | (ADC_PRE << 16); //ADC clock from PCLK2
+    ADC1->CR1 |= (1 << 8);			                //SCAN mode enabled (Bit8)
+	ADC1->CR1 &= ~(3 << 24);				        //12bit resolution (Bit24,25 0b00)
+	ADC1->SQR1 &= ~(0x0F << 20);                    
+	ADC1->SQR1 |= ((ADC_CHANNELS - 1) << 20);       //Number of conversions in sequence (L[3:0])
+	ADC1->SQR3 &= ~(0x3FFFFFFF);	                //Clears whole 1st 30bits in register
+	ADC1->SQR3 |= (4 << 0) | (5 << 5) | (6 << 10) | (7 << 15); //Sequence: channel 4, 5, 6, 7 (KEYS, VDD, MTR, TMP)
+	ADC1->SMPR2 &= ~(0xFFF << 12);
+	ADC1->SMPR2 |= (ADC_SMP_KEYS << 12) | (ADC_SMP_VDD << 15) | (ADC_SMP_MTR << 18) | (ADC_SMP_TMP << 21); //Sample time SMP4:SMP7
+	ADC1->CR2 &= ~(1 << 11);			            //Right alignment of data bits  bit12....bit0
+	
+	//Analog watchdog on key ladder: IRQ only if a key pulls below KEY_AWD_LTR
+	ADC1->LTR = KEY_AWD_LTR;
+	ADC1->HTR = 0xFFF;
+	ADC1->CR1 &= ~0x1F;
+	ADC1->CR1 |= (4 << 0)                           //AWDCH: channel 4 (KEYS)
+	           | (1 << 9)                           //AWDSGL: this channel only
+	           | (1 << 23);                         //AWDEN: regular channels, AWDIE is set by key_sleep()
+	NVIC_SetPriority(ADC_IRQn, 2);
+	NVIC_EnableIRQ(ADC_IRQn);
+	
+	//DMA2 stream 0 channel 0: ADC1->DR to adc_buf, circular
+	DMA2_Stream0->CR = 0;
+	while(DMA2_Stream0->CR & 1);
+	DMA2->LIFCR = 0x3D;                             //Clear all flags of stream 0
+	DMA2_Stream0->PAR = (uint32_t) &ADC1->DR;
+	DMA2_Stream0->M0AR = (uint32_t) adc_buf;
+	DMA2_Stream0->NDTR = ADC_AVG * ADC_CHANNELS;
+	DMA2_Stream0->CR = (0 << 25)                    //Channel 0
+	                 | (1 << 13) | (1 << 11)        //MSIZE, PSIZE 16 bit
+	                 | (1 << 10)                    //MINC
+	                 | (1 << 8);                    //CIRC, DIR periph. to memory
+	DMA2_Stream0->CR |= 1;                          //EN
+	
+    ADC1->CR2 |= (1 << 1) | (1 << 8) | (1 << 9);    //CONT, DMA, DDS (DMA requests continue)
+    ADC1->CR2 |= (1 << 0);                          //Switch on ADC1
+    for(t1 = 0; t1 < 1000; t1++);                   //tSTAB
+    ADC1->CR2 |= (1 << 30);                         //Start conversion SWSTART bit, runs from now on 
+    while(!(DMA2->LISR & (1 << 5)));                //Buffer filled once (TCIF0)
+}	
+	
+//Read ADC value: average of the latest scans, no conversion wait
+int get_adc(int adc_channel)
+{
+	int t1, adc_val = 0;
+	
+	for(t1 = adc_channel - 1; t1 < ADC_AVG * ADC_CHANNELS; t1 += ADC_CHANNELS)
+	{
+		adc_val += adc_buf[t1];
+	}	
+			
+	return adc_val / ADC_AVG;
+}	
+
+//Classify key ladder voltage (ADC channel 4), -1 = no key
+int key_decode(int adcval)
+{
+    int key_value[] = {370, 735, 1320, 2462, 1863, 3135};
+    int t1;
+    
+   	if(adcval > 4000) //NO key pressed
+   	{
+		return -1;
+	}
+	
+    for(t1 = 0; t1 < 6; t1++)
+    {
+		if((adcval > (key_value[t1] - 100)) && (adcval < (key_value[t1] + 100)))
+		{
+			return t1;
+		}
+	}
+	return -2; //Between two levels, key still settling
+}	
+
+//Key state machine, called from SysTick every 10ms
+void key_scan(void)
+{
+	static int key_last = -1, key_cnt = 0;
+	static int held = -1, held_ticks = 0, long_sent = 0;
+	int key = key_decode(get_adc(KEYS));
+	
+	//Debounce: level must be stable for KEY_DEBOUNCE ticks
+	if(key != key_last)
+	{
+		key_last = key;
+		key_cnt = 0;
+		return;
+	}
+	if(key_cnt < KEY_DEBOUNCE)
+	{
+		key_cnt++;
+		return;
+	}
+	if(key == -2)
+	{
+		return;
+	}	
+	
+	if(held == -1)
+	{
+		if(key == -1) //Nothing pressed, stable
+		{
+			key_sleep();
+			return;
+		}	
+		if(key >= 0) //Pressed
+		{
+			held = key;
+			held_ticks = 0;
+			long_sent = 0;
+			key_put(KEY_EV_PRESS | held);
+		}
+		return;
+	}
+	
+	if(key == held) //Still pressed
+	{
+		if(!long_sent && (++held_ticks >= KEY_LONG))
+		{
+			key_put(KEY_EV_LONG | held);
+			long_sent = 1;
+		}
+		return;
+	}
+			
+	//Released (or other key)
+	if(!long_sent)
+	{
+		key_put(KEY_EV_SHORT | held);
+	}	
+	held = -1;	
+}	
+
+//Stop key scan until analog watchdog sees a key
+void key_sleep(void)
+{
+	key_awake = 0;
+	ADC1->SR = ~(1 << 0);                  //Stale AWD flag (rc_w0)
+	ADC1->CR1 |= (1 << 6);                 //AWDIE
+}	
+
+//Put key event into queue (SysTick only), dropped if queue is full
+void key_put(int ev)
+{
+	spsc_put(&key_evq, ev);
+}
+
+//Get next key event (main loop only), -1 if none
+int key_get(void)
+{
+	return spsc_get(&key_evq);
+}
+	
+//Read keys, does not block: 0:5 short press, 6:11 long press, -1 none
+int get_keys(void)
+{
+	int ev;
+	
+	while((ev = key_get()) != -1)
+	{
+		if((ev & KEY_EV_MASK) == KEY_EV_PRESS)
+		{
+			continue;
+		}
+		
+		msg_deadline = deadline(MSG_TIME);
+		if((ev & KEY_EV_MASK) == KEY_EV_SHORT)
+		{
+			show_key(ev & 0x0F);
+		    return ev & 0x0F;
+		}
+	    show_key((ev & 0x0F) + 6);
+		return (ev & 0x0F) + 6;
+    }
+    
+    return -1;
+}
+
+//Feed telemetry filters with the averaged DMA samples
+void tel_update(void)
+{
+	uint32_t v = get_adc(VDD) << 4, t = get_adc(TMP) << 4;
+	
+	if(!tel_vdd_q4)                    //First call: start at sample
+	{
+		tel_vdd_q4 = v | 1;
+		tel_tmp_q4 = t;
+		return;
+	}
+	tel_vdd_q4 += ((int32_t) (v - tel_vdd_q4)) >> TEL_FILTER;
+	tel_tmp_q4 += ((int32_t) (t - tel_tmp_q4)) >> TEL_FILTER;
+}	
+
+//VDD in 0.01V
+int tel_vdd100(void)
+{
+	if(!tel_vdd_q4)
+	{
+		tel_update();
+	}
+	return (tel_vdd_q4 * TEL_VDD_SCALE + 32768) >> 16;
+}
+
+//PA temperature in 0.1°C, interpolated in KTY81 table, end segments extrapolated
+int tel_tmp10(void)
+{
+	int a, i = 0;
+	
+	if(!tel_vdd_q4)
+	{
+		tel_update();
+	}
+	a = tel_tmp_q4;
+	while(i < TEL_KTY_N - 2 && a >= (tel_kty[i + 1] << 4))
+	{
+		i++;
+	}	
+	return (TEL_KTY_T0 + i * TEL_KTY_STEP) * 10 
+	     + (a - (tel_kty[i] << 4)) * (TEL_KTY_STEP * 10) / ((tel_kty[i + 1] - tel_kty[i]) << 4);
+}	
+
+//Measure voltage (0.1V)
+int get_vdd(void)
+{
+	return (tel_vdd100() + 5) / 10;
+}
+
+//Get adc value for PWR-meter
+int get_txpwr(void)
+{
+    int adcval =  get_adc(MTR) >> 4;
+	return adcval;	
+}
+
+//KTY81-210 temperature (°C)
+int get_pa_temp(void)
+{
+	int t10 = tel_tmp10();
+	
+	return (t10 >= 0) ? (t10 + 5) / 10 : (t10 - 5) / 10;
+}	
+
+int get_txrx(void)
+{
+    int pin_input = ~TXRX_GPIO->IDR; //"0" means "pressed"!
+	if(pin_input & (1 << TXRX_PIN))
+	{
+        return 1;
+    }	
+    else
+	{
+        return 0;
+    }	    
+}	
+
+  /////////////////
+ //  SPI  DDS   // 
+/////////////////
+void spi_send_byte(unsigned int sbyte)
+{
+    int t1, x = (1 << 7);
+	
+	for(t1 = 0; t1 < 8; t1++)
+	{
+	    DDS_GPIO->ODR &= ~(1 << DDS_SCLK);  //DDS_SCLK lo
+    	
+        //Bit set or erase
+	    if(sbyte & x)
+	    {
+		    DDS_GPIO->ODR |= (1 << DDS_SDIO);  
 	    }
 	    else
 	    {
@@ -1288,41 +2230,49 @@ void spi_send_byte(unsigned int sbyte)
 	}	
 }
 
-//Set frequency for AD9951 DDS
-void set_frequency(unsigned long frequency)
+//Correct reference clock from output frequency f_meas measured
+//while DDS was set to f_set and store it in EEPROM (CAT "CL<Hz>;")
+void dds_calibrate(unsigned long f_set, unsigned long f_meas)
 {
-    //unsigned long interfreq = 10E06; //Interfrequency of radio in Hz
-    unsigned long f;
-    unsigned long fword;
-    int t1, shiftbyte = 24, resultbyte;
-    unsigned long comparebyte = 0xFF000000;
-	
-	f = frequency; //Offset because of inaccuracy of crystal oscillator
+	dds_set_clock((unsigned long long) dds_clock * f_meas / f_set);
+	eeprom_store_frequency(9, 0, dds_clock);
+	mem_prepare(); //Tuning words of memory channels
+}
 	
-    //Calculate frequency word
-    //2³² / fClk = ----
-    
-    //Clock rate =  75MHz
-    //fword = (unsigned long) f * 57.266230613;
-    
-    //Clock rate =  100MHz
-    //fword = (unsigned long) f * 42.94967296;
-        
-    //Clock rate =  110MHz
-    //fword = (unsigned long) f * 39.045157236;
-    
-    //Clock rate =  125MHz
-    //fword = (unsigned long) f * 34.358675; 
-        	
-	//Clock rate =  200MHz
-    //fword = (unsigned long) f * 21.47478;  //..36448
+//Send precomputed tuning word
+void dds_write_ftw(unsigned long fword)
+{
+	PROF_BEGIN();
+    int t1;
     
-    //Clock rate =  300MHz
-    //fword = (unsigned long) f * 14.316557653;
+    IO_COUNT(dds, 5);
+#ifdef DDS_HW_SPI
+	while(dds_busy);  //Previous word still in transfer
     
-    //Clock rate =  400MHz
-    fword = (unsigned long) (f + INTERFREQUENCY) * 10.73741824;
+	dds_buf[0] = 0x04; //Instruction byte: write FTW register
+	for(t1 = 0; t1 < 4; t1++) //MSB first
+	{
+		dds_buf[t1 + 1] = fword >> (24 - (t1 << 3));
+	}
 		
+	DDS_GPIO->BSRR = (1 << (DDS_IO_UD + 16)); //DDS_IO_UD lo
+	
+	DMA1_Stream4->CR &= ~(1 << 0);              //Stream off
+	while(DMA1_Stream4->CR & (1 << 0));
+	DMA1->HIFCR = (0x3D << 0);                  //Clear all flags of stream 4
+	DMA1_Stream4->PAR = (uint32_t) &SPI2->DR;
+	DMA1_Stream4->M0AR = (uint32_t) dds_buf;
+	DMA1_Stream4->NDTR = 5;
+	DMA1_Stream4->CR = (0 << 25)                //Channel 0: SPI2_TX
+	                 | (1 << 10)                //Memory increment, 8 bit
+	                 | (1 << 6)                 //Memory to peripheral
+	                 | (1 << 4)                 //Transfer complete interrupt
+	                 | (1 << 2);                //Transfer error interrupt
+	dds_busy = 1;
+	DMA1_Stream4->CR |= (1 << 0);               //Stream on, IO_UD is raised in ISR
+#else
+    int shiftbyte = 24, resultbyte;
+    unsigned long comparebyte = 0xFF000000;
 	
     //Start transfer to DDS
     DDS_GPIO->ODR &= ~(1 << DDS_IO_UD); //DDS_IO_UD lo
@@ -1342,402 +2292,1901 @@ void set_frequency(unsigned long frequency)
 	
 	//End transfer sequence
     DDS_GPIO->ODR |= (1 << DDS_IO_UD); //DDS_IO_UD hi 
+#endif
+	PROF_END(PRF_DDS);
 }
 
   //////////////////////
- //   I2C commands   //
+ //   I2C engine     //
 //////////////////////
-void i2c_start(void) 
+//Transactions are queued and run by the I2C1 event and error
+//interrupts. A write phase (wlen bytes) is followed by a repeated
+//start and a read phase (rlen bytes). Data phases are moved by DMA1
+//(stream 6 TX, stream 0 RX), single byte reads by RXNE interrupt.
+//I2C1 clock registers for I2C_SPEED (standard mode) from clk_pclk1
+void i2c_timing(void)
+{
+	unsigned long mhz = clk_pclk1 / 1000000;
+	
+	I2C1->CR1 &= ~I2C_CR1_PE;
+	I2C1->CR2 = (I2C1->CR2 & ~0x3F) | mhz;        //Peripheral clock in MHz
+	I2C1->CCR = clk_pclk1 / (2 * I2C_SPEED);       //Thigh = Tlow = CCR * Tpclk1
+	I2C1->TRISE = mhz + 1;                         //Maximum rise time 1000ns
+	I2C1->CR1 |= I2C_CR1_PE;
+}	
+
+void i2c_init(void)
+{
+	RCC->APB1ENR |= RCC_APB1ENR_I2C1EN; //Enable I2C clock
+    RCC->AHB1ENR |= (1 << 1);          //GPIOB power up
+    RCC->AHB1ENR |= (1 << 21);         //DMA1 power up
+    GPIOB->MODER &= ~(3 << (6 << 1)); //PB6 as SCK
+    GPIOB->MODER |=  (2 << (6 << 1)); //Alternate function
+    GPIOB->OTYPER |= (1 << 6);        //open-drain
+    GPIOB->MODER &= ~(3 << (9 << 1)); //PB9 as SDA
+    GPIOB->MODER |=  (2 << (9 << 1)); //Alternate function
+    GPIOB->OTYPER |= (1 << 9);        //open-drain
+
+    //Choose AF4 option for I2C1 in Alternate Function registers
+    GPIOB->AFR[0] |= (4 << (6 << 2));     // for PB6
+    GPIOB->AFR[1] |= (4 << ((9 - 8) << 2)); // for PB9
+
+    //Reset and clear control register
+    I2C1->CR1 = I2C_CR1_SWRST;
+    I2C1->CR1 = 0;
+
+    //Enable event and error interrupt
+    I2C1->CR2 = I2C_CR2_ITERREN | I2C_CR2_ITEVTEN; 
+
+    i2c_timing();
+    
+    //DMA streams, address and length are set per transaction
+    DMA1_Stream6->CR = (1 << 25) | (1 << 10) | (1 << 6);            //Ch1 I2C1_TX, MINC, memory to peripheral
+    DMA1_Stream6->PAR = (uint32_t) &I2C1->DR;
+    DMA1_Stream0->CR = (1 << 25) | (1 << 10) | (1 << 4) | (1 << 2); //Ch1 I2C1_RX, MINC, TC and TE interrupt
+    DMA1_Stream0->PAR = (uint32_t) &I2C1->DR;
+    
+    NVIC_SetPriority(I2C1_EV_IRQn, 2);
+    NVIC_SetPriority(I2C1_ER_IRQn, 2);
+    NVIC_SetPriority(DMA1_Stream0_IRQn, 2);
+    NVIC_EnableIRQ(I2C1_EV_IRQn);
+    NVIC_EnableIRQ(I2C1_ER_IRQn);
+    NVIC_EnableIRQ(DMA1_Stream0_IRQn);
+    
+    //Enable I2C
+    I2C1->CR1 |= I2C_CR1_PE; 
+}
+
+//Start transaction at head of queue
+static void i2c_begin(void)
+{
+	i2c_cur = &i2c_q[i2c_head];
+	i2c_phase = (i2c_cur->wlen) ? I2C_PH_WRITE : I2C_PH_READ;
+	i2c_deadline = deadline(I2C_TIMEOUT);
+	I2C1->CR1 |= I2C_CR1_ACK;
+	I2C1->CR1 |= I2C_CR1_START;
+}	
+
+//Close current transaction, report status and go on with next one
+static void i2c_finish(int status)
+{
+	struct i2c_xfer *x = i2c_cur;
+	long t1 = 0;
+	
+	DMA1_Stream6->CR &= ~(1 << 0);
+	DMA1_Stream0->CR &= ~(1 << 0);
+	I2C1->CR2 &= ~(I2C_CR2_DMAEN | I2C_CR2_LAST | I2C_CR2_ITBUFEN);
+	while((I2C1->CR1 & I2C_CR1_STOP) && t1++ < 10000); //STOP must be out before next START
+	
+	i2c_cur = 0;
+	x->status = status;
+	if(x->done)
+	{
+		x->done(x);
+	}
+		
+	i2c_head = (i2c_head + 1) % I2C_QUEUE;
+	if(i2c_head != i2c_tail)
+	{
+		i2c_begin();
+	}
+	else
+	{
+		i2c_active = 0;
+	}		
+}	
+
+//Queue a transaction, wdata is copied. Blocks only if queue is full.
+//flags: I2C_ACKPOLL
+struct i2c_xfer *i2c_submit(int i2c_adr, uint8_t *wdata, int wlen, uint8_t *rbuf, int rlen, void (*done)(struct i2c_xfer*), int flags)
+{
+	struct i2c_xfer *x;
+	int t1;
+	
+	IO_COUNT(i2c, 1 + wlen + rlen);
+	while((i2c_tail + 1) % I2C_QUEUE == i2c_head)
+	{
+		i2c_poll();
+	}	
+	
+	if(wlen > I2C_XBUF)
+	{
+		wlen = I2C_XBUF;
+	}
+		
+	x = &i2c_q[i2c_tail];
+	x->adr = i2c_adr;
+	for(t1 = 0; t1 < wlen; t1++)
+	{
+		x->wbuf[t1] = wdata[t1];
+	}
+	x->wlen = wlen;
+	x->rbuf = rbuf;
+	x->rlen = rlen;
+	x->done = done;
+	x->flags = flags;
+	x->status = I2C_BUSY;
+	
+	i2c_tail = (i2c_tail + 1) % I2C_QUEUE; //Publish to ISR
+	if(!i2c_active)
+	{
+		i2c_active = 1;
+		i2c_begin();
+	}
+	return x;
+}
+
+//Wait for completion of a transaction (from main context only)
+int i2c_wait(struct i2c_xfer *x)
+{
+	while(x->status == I2C_BUSY)
+	{
+		i2c_poll();
+	}
+	return x->status;
+}			
+
+//Free a stuck bus: clock out up to 9 bits until slave releases SDA,
+//send STOP by hand and restart peripheral 
+static void i2c_recover(void)
+{
+	int t1;
+	
+	I2C1->CR1 &= ~I2C_CR1_PE;
+	GPIOB->ODR |= (1 << 6) | (1 << 9);
+	GPIOB->MODER &= ~((3 << (6 << 1)) | (3 << (9 << 1)));
+	GPIOB->MODER |= (1 << (6 << 1)) | (1 << (9 << 1)); //Open-drain GPIO output
+	
+	for(t1 = 0; t1 < 9 && !(GPIOB->IDR & (1 << 9)); t1++)
+	{
+		GPIOB->ODR &= ~(1 << 6);
+		delay_us(5);
+		GPIOB->ODR |= (1 << 6);
+		delay_us(5);
+	}
+	
+	GPIOB->ODR &= ~(1 << 6);
+	GPIOB->ODR &= ~(1 << 9);
+	delay_ms(1);
+	GPIOB->ODR |= (1 << 6);
+	delay_ms(1);
+	GPIOB->ODR |= (1 << 9);
+	delay_ms(1);
+	
+	i2c_init();
+}		
+
+//Watchdog for running transaction, call regularly from main context
+void i2c_poll(void)
 {
-    I2C1->CR1 |= I2C_CR1_START;
-    while(!(I2C1->SR1 & I2C_SR1_SB));
+	if(i2c_active && expired(i2c_deadline))
+	{
+		NVIC_DisableIRQ(I2C1_EV_IRQn);
+		NVIC_DisableIRQ(I2C1_ER_IRQn);
+		NVIC_DisableIRQ(DMA1_Stream0_IRQn);
+		i2c_recover();
+		if(i2c_cur)
+		{
+		    i2c_finish(I2C_TIMEDOUT);
+		}
+		else
+		{
+			i2c_active = 0;
+		}		
+		NVIC_EnableIRQ(I2C1_EV_IRQn);
+		NVIC_EnableIRQ(I2C1_ER_IRQn);
+		NVIC_EnableIRQ(DMA1_Stream0_IRQn);
+	}
+}		
+
+//Event interrupt: runs the state machine
+extern "C" void I2C1_EV_IRQHandler(void)
+{
+	uint32_t sr1 = I2C1->SR1;
+	struct i2c_xfer *x = i2c_cur;
+	
+	if(!x)
+	{
+		(void)I2C1->SR2;
+		return;
+	}
+		
+	if(sr1 & I2C_SR1_SB) //Start sent: address
+	{
+		i2c_acked = 0;
+		if(i2c_phase == I2C_PH_WRITE)
+		{
+			I2C1->DR = x->adr;
+		}
+		else
+		{	
+			I2C1->DR = x->adr | 0x01;
+		}	
+		return;
+	}	
+	
+	if(sr1 & I2C_SR1_ADDR) //Address acknowledged: start data phase
+	{
+		i2c_acked = 1;
+		if(i2c_phase == I2C_PH_WRITE)
+		{
+			DMA1->HIFCR = (0x3D << 16);
+			DMA1_Stream6->M0AR = (uint32_t) x->wbuf;
+			DMA1_Stream6->NDTR = x->wlen;
+			DMA1_Stream6->CR |= (1 << 0);
+			I2C1->CR2 |= I2C_CR2_DMAEN;
+			(void)I2C1->SR2;
+		}
+		else if(x->rlen == 1)
+		{
+			I2C1->CR1 &= ~I2C_CR1_ACK;    //NACK the only byte
+			(void)I2C1->SR2;
+			I2C1->CR1 |= I2C_CR1_STOP;
+			I2C1->CR2 |= I2C_CR2_ITBUFEN; //Wait for RXNE
+		}
+		else
+		{
+			DMA1->LIFCR = (0x3D << 0);
+			DMA1_Stream0->M0AR = (uint32_t) x->rbuf;
+			DMA1_Stream0->NDTR = x->rlen;
+			DMA1_Stream0->CR |= (1 << 0);
+			I2C1->CR2 |= I2C_CR2_DMAEN | I2C_CR2_LAST; //NACK after last DMA byte
+			(void)I2C1->SR2;
+		}
+		return;
+	}
+	
+	if((sr1 & I2C_SR1_BTF) && i2c_phase == I2C_PH_WRITE && !DMA1_Stream6->NDTR) //All bytes out
+	{
+		I2C1->CR2 &= ~I2C_CR2_DMAEN;
+		if(x->rlen)
+		{
+			i2c_phase = I2C_PH_READ;
+			I2C1->CR1 |= I2C_CR1_START; //Repeated start
+		}
+		else
+		{
+			I2C1->CR1 |= I2C_CR1_STOP;
+			i2c_finish(I2C_OK);
+		}
+		return;
+	}
+	
+	if((sr1 & I2C_SR1_RXNE) && i2c_phase == I2C_PH_READ && x->rlen == 1)
+	{
+		x->rbuf[0] = I2C1->DR;
+		i2c_finish(I2C_OK);
+	}
+}
+
+//Error interrupt: NACK, bus error, arbitration lost
+extern "C" void I2C1_ER_IRQHandler(void)
+{
+	uint32_t sr1 = I2C1->SR1;
+	struct i2c_xfer *x = i2c_cur;
+	long t1 = 0;
+	
+	I2C1->SR1 = 0; //Clear error flags (rc_w0)
+	if(x && (sr1 & I2C_SR1_AF) && !i2c_acked && (x->flags & I2C_ACKPOLL))
+	{
+		//ACK polling: device busy with write cycle, try again (i2c_poll() limits time)
+		I2C1->CR1 |= I2C_CR1_STOP;
+		while((I2C1->CR1 & I2C_CR1_STOP) && t1++ < 10000);
+		i2c_phase = (x->wlen) ? I2C_PH_WRITE : I2C_PH_READ;
+		I2C1->CR1 |= I2C_CR1_START;
+		return;
+	}
+		
+	if(x)
+	{
+		if(!(sr1 & I2C_SR1_ARLO))
+		{
+			I2C1->CR1 |= I2C_CR1_STOP;
+		}
+		i2c_finish(I2C_ERR);
+	}
+}
+
+//DMA1 Stream0: I2C1 RX complete
+extern "C" void DMA1_Stream0_IRQHandler(void)
+{
+	uint32_t isr = DMA1->LISR;
+	
+	DMA1->LIFCR = (0x3D << 0);
+	if(i2c_cur && (isr & ((1 << 5) | (1 << 3))))
+	{
+		I2C1->CR1 |= I2C_CR1_STOP;
+		i2c_finish((isr & (1 << 5)) ? I2C_OK : I2C_ERR);
+	}
+}
+
+  //////////////////////
+ //   I2C commands   //
+//////////////////////
+//Writes are queued and return at once, reads wait for their result
+void i2c_write_byte1(uint8_t regaddr, uint8_t data, int i2c_adr) 
+{
+	uint8_t d[2];
+	
+	d[0] = regaddr;
+	d[1] = data;
+	i2c_submit(i2c_adr, d, 2, 0, 0, 0, 0);
+}
+
+//Write multiple number of bytes (>1)
+void i2c_write_byte2(uint8_t *data, uint8_t n, int i2c_adr) 
+{
+	i2c_submit(i2c_adr, data, n, 0, 0, 0, 0);
+}
+
+int16_t i2c_read(uint8_t regaddr, int i2c_adr) 
+{
+    uint8_t reg = 0;
+
+    i2c_wait(i2c_submit(i2c_adr, &regaddr, 1, &reg, 1, 0, 0));
+
+    return reg;
+}
+
+int16_t i2c_read2(uint16_t regaddr, int i2c_adr) 
+{
+    uint8_t reg = 0;
+    uint8_t r[2];
+    
+    r[0] = (regaddr & 0xFF00) >> 8; //MSB
+    r[1] = regaddr & 0x00FF;        //LSB
+    i2c_wait(i2c_submit(i2c_adr, r, 2, &reg, 1, 0, I2C_ACKPOLL));
+
+    return reg;
+}
+
+  //////////////////////
+ // Si5351A commands //
+//////////////////////
+//Burst done (ISR context): on failure the chip state of the sent range
+//is unknown, so the shadow must not suppress the next write
+static void si5351_done(struct i2c_xfer *x)
+{
+	if(x->status != I2C_OK)
+	{
+		si5351_invalidate(x->wbuf[0], x->wlen - 1);
+	}
+}
+
+//Si5351 transport of trx_core.c: queued burst, buf is copied
+void si5351_bus_write(uint8_t *buf, int n)
+{
+	i2c_submit(SI5351_ADR, buf, n, 0, 0, si5351_done, 0);
+}
+
+
+  ///////////////////////////
+ //   EEPROM 24C65        //
+///////////////////////////
+//Page write: n bytes from data, split at page boundaries. Returns at
+//once, the write cycle of each page is covered by ACK polling of the
+//next access to the EEPROM.
+void eeprom_write_page(uint16_t mem_address, uint8_t *data, int n)
+{
+	uint8_t buf[2 + EEPROM_PAGESIZE];
+	int t1, len;
+	
+	while(n > 0)
+	{
+		len = EEPROM_PAGESIZE - (mem_address % EEPROM_PAGESIZE); //Room left in page
+		if(len > n)
+		{
+			len = n;
+		}
+			
+		buf[0] = mem_address >> 8;   //Address of byte in 24C65 MSB
+        buf[1] = mem_address & 0xFF; //                         LSB
+        for(t1 = 0; t1 < len; t1++)
+        {
+			buf[t1 + 2] = *data++;
+		}
+		i2c_submit(EEPROM_ADR, buf, len + 2, 0, 0, 0, I2C_ACKPOLL);
+		
+		mem_address += len;
+		n -= len;
+	}
+}			
+
+//Sequential read: n bytes into buf, waits for result
+void eeprom_read_seq(uint16_t mem_address, uint8_t *buf, int n)
+{
+	uint8_t adr[2];
+	int len;
+	
+	while(n > 0)
+	{
+		len = (n > 255) ? 255 : n;
+		adr[0] = mem_address >> 8;
+		adr[1] = mem_address & 0xFF;
+		i2c_wait(i2c_submit(EEPROM_ADR, adr, 2, buf, len, 0, I2C_ACKPOLL));
+		
+		mem_address += len;
+		buf += len;
+		n -= len;
+	}
+}
+
+void eeprom_write(uint16_t mem_address, uint8_t value)
+{
+   eeprom_write_page(mem_address, &value, 1);
+}	
+
+uint8_t eeprom_read(uint16_t mem_address)
+{
+   uint8_t r = 0;
+   
+   eeprom_read_seq(mem_address, &r, 1);
+   return r;
+}	
+
+//Long values are stored MSB first
+void eeprom_put_long(uint8_t *p, long v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+	
+long eeprom_get_long(uint8_t *p)
+{
+	return ((unsigned long) p[0] << 24) | ((unsigned long) p[1] << 16) | ((unsigned int) p[2] << 8) | p[3];
+}
+
+  ////////////////////////////////////
+ //   EEPROM & Mem functions       //
+////////////////////////////////////
+//Check if freq is in respective band
+int is_freq_ok(long f, int cband)
+{
+	
+	if(f >= band_f0[cband] && f <= band_f1[cband])
+	{
+	    return 1;
+	}	
+	return 0;		
+}
+
+long eeprom_load_frequency(int band, int vfo)
+{
+    uint8_t buf[4];
+    int start_adr = vfo * 4 + band * 8 + 128;
+		
+    eeprom_read_seq(start_adr, buf, 4);
+	return eeprom_get_long(buf);
+}
+
+void eeprom_store_frequency(int band, int vfo, long f)
+{
+    uint8_t buf[4];
+    int start_adr = vfo * 4 + band * 8 + 128;
+    
+    eeprom_put_long(buf, f);
+    eeprom_write_page(start_adr, buf, 4);
+}
+
+//Whole VFO table (bytes 191:128) in 2 page writes
+void save_all_vfos(void)
+{
+	int t0, t1;
+	uint8_t buf[MAXBANDS * 8];
+	
+	for(t0 = 0; t0 < MAXBANDS; t0++)
+	{
+		for(t1 = 0; t1 < 2; t1++)
+		{
+			eeprom_put_long(buf + t0 * 8 + t1 * 4, f_vfo[t0][t1]);
+		}
+	}
+	eeprom_write_page(128, buf, MAXBANDS * 8);
+	eeprom_write(257, cur_vfo); //Last VFO in use
+}			
+
+//Boot state: newest log record, the legacy layout only without one.
+//Legacy VFOs, LOs (band 8) and DDS clock (band 9) are one bulk read.
+//Returns 1 if a log record was found.
+int boot_load(void)
+{
+	uint8_t buf[MAXBANDS * 8 + 12];
+	int t0, t1, p = persist_load();
+	
+	if(p)
+	{
+		eeprom_read_seq(128 + MAXBANDS * 8 + 8, buf, 4); //DDS clock only
+		dds_set_clock(eeprom_get_long(buf));
+		return 1;
+	}	
+	
+	eeprom_read_seq(128, buf, MAXBANDS * 8 + 12);
+	for(t0 = 0; t0 < MAXBANDS; t0++)
+	{
+		for(t1 = 0; t1 < 2; t1++)
+		{
+			f_vfo[t0][t1] = eeprom_get_long(buf + t0 * 8 + t1 * 4);
+			if(!is_freq_ok(f_vfo[t0][t1], t0))
+			{
+				f_vfo[t0][t1] = f_vfo0[t0][t1];
+			}	 
+		}
+	}
+	f_lo[0] = eeprom_get_long(buf + MAXBANDS * 8);
+	f_lo[1] = eeprom_get_long(buf + MAXBANDS * 8 + 4);
+	dds_set_clock(eeprom_get_long(buf + MAXBANDS * 8 + 8));
+	
+	eeprom_read_seq(256, buf, 2);
+	cur_band = buf[0];
+	cur_vfo = buf[1];
+	return 0;
+}	
+
+  ////////////////////////////////////
+ //   Persistence log              //
+////////////////////////////////////
+//Radio state is written behind as a record with sequence number and
+//CRC to the next slot of the log region, after PERSIST_QUIET ms
+//without change. Boot takes the valid record with highest sequence.
+//Record: magic, seq(4), band, vfo, sideband, f_vfo(64), f_lo(8), CRC16
+uint16_t crc16(uint8_t *data, int n)
+{
+	uint16_t crc = 0xFFFF;
+	int t1;
+	
+	while(n--)
+	{
+		crc ^= (uint16_t) *data++ << 8;
+		for(t1 = 0; t1 < 8; t1++)
+		{
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1); //CCITT
+		}
+	}
+	return crc;
+}
+
+//Mark state as changed
+void persist_touch(void)
+{
+	persist_dirty = 1;
+	persist_deadline = deadline(PERSIST_QUIET);
+}	
+
+//Write state to next slot of log region (queued, does not block)
+void persist_flush(void)
+{
+	PROF_BEGIN();
+	uint8_t r[PERSIST_LEN];
+	int t0, t1, p = 0;
+	uint16_t crc;
+	
+	persist_seq++;
+	persist_slot = (persist_slot + 1) % PERSIST_SLOTS;
+	
+	r[p++] = PERSIST_MAGIC;
+	eeprom_put_long(r + p, persist_seq);
+	p += 4;
+	r[p++] = cur_band;
+	r[p++] = cur_vfo;
+	r[p++] = sideband;
+	for(t0 = 0; t0 < MAXBANDS; t0++)
+	{
+		for(t1 = 0; t1 < 2; t1++)
+		{
+			eeprom_put_long(r + p, f_vfo[t0][t1]);
+			p += 4;
+		}
+	}
+	for(t1 = 0; t1 < 2; t1++)
+	{
+		eeprom_put_long(r + p, f_lo[t1]);
+		p += 4;
+	}
+	crc = crc16(r, p);
+	r[p++] = crc >> 8;
+	r[p++] = crc & 0xFF;
+	
+	eeprom_write_page(PERSIST_BASE + persist_slot * PERSIST_RECSIZE, r, p);
+	persist_dirty = 0;
+	PROF_END(PRF_PERSIST);
+}
+
+//Flush after quiet period
+void persist_poll(void)
+{
+	if(persist_dirty && expired(persist_deadline))
+	{
+		persist_flush();
+	}
+}		
+
+//Load newest valid record, returns 0 if there is none
+int persist_load(void)
+{
+	uint8_t r[PERSIST_LEN];
+	unsigned long seq[PERSIST_SLOTS];
+	int t0, t1, p, best, n = 0;
+	
+	//Headers up to the first drop of the sequence number: slots are
+	//written in turn, so the slot before the drop is the newest one
+	for(t1 = 0; t1 < PERSIST_SLOTS; t1++)
+	{
+		seq[t1] = 0;
+	}	
+	while(n < PERSIST_SLOTS)
+	{
+		eeprom_read_seq(PERSIST_BASE + n * PERSIST_RECSIZE, r, 5);
+		seq[n] = (r[0] == PERSIST_MAGIC) ? (unsigned long) eeprom_get_long(r + 1) : 0;
+		if(n++ && seq[n - 1] < seq[n - 2])
+		{
+			break;
+		}	
+	}
+	
+	for(;;)
+	{
+		best = -1;
+		for(t1 = 0; t1 < PERSIST_SLOTS; t1++)
+		{
+			if(seq[t1] && (best < 0 || seq[t1] > seq[best]))
+			{
+				best = t1;
+			}
+		}
+		if(best < 0)
+		{
+			if(n < PERSIST_SLOTS) //Older records may be behind the drop
+			{
+				for(; n < PERSIST_SLOTS; n++)
+				{
+					eeprom_read_seq(PERSIST_BASE + n * PERSIST_RECSIZE, r, 5);
+					seq[n] = (r[0] == PERSIST_MAGIC) ? (unsigned long) eeprom_get_long(r + 1) : 0;
+				}
+				continue;
+			}	
+			return 0; //Empty or erased log
+		}
+		
+		eeprom_read_seq(PERSIST_BASE + best * PERSIST_RECSIZE, r, PERSIST_LEN);
+		if(crc16(r, PERSIST_LEN - 2) == (((uint16_t) r[PERSIST_LEN - 2] << 8) | r[PERSIST_LEN - 1]))
+		{
+			break;
+		}
+		seq[best] = 0; //Damaged, e.g. power loss while writing: try older one
+	}
+	
+	persist_seq = seq[best];
+	persist_slot = best;
+	p = 5;
+	cur_band = r[p++];
+	cur_vfo = r[p++];
+	sideband = r[p++];
+	for(t0 = 0; t0 < MAXBANDS; t0++)
+	{
+		for(t1 = 0; t1 < 2; t1++)
+		{
+			f_vfo[t0][t1] = eeprom_get_long(r + p);
+			p += 4;
+			if(!is_freq_ok(f_vfo[t0][t1], t0))
+			{
+				f_vfo[t0][t1] = f_vfo0[t0][t1];
+			}
+		}
+	}
+	for(t1 = 0; t1 < 2; t1++)
+	{
+		f_lo[t1] = eeprom_get_long(r + p);
+		p += 4;
+	}
+	return 1;
+}
+	
+///////////////////////
+//      LO SET       //     
+///////////////////////
+//Enter LO setting for sideband sb (LSB=0, USB=1), encoder tunes it in
+//tune_vfo(), key 6 aborts, key 7 stores (task_keys())
+void set_lo(int sb)
+{
+	page = PAGE_LO;
+	lo_sb = sb;
+	lo_f = f_lo[sb];
+	show_sideband(sb, 1);
+	show_frequency1(lo_f, 2);
+}
+
+//Leave LO setting, keep (store = 1) or drop the new frequency. LO
+//images are rebuilt from f_lo[] and the LO of current sideband loaded.
+void lo_close(int store)
+{
+	page = PAGE_MAIN;
+	if(store)
+	{
+		f_lo[lo_sb] = lo_f;
+	}
+	band_prepare();
+	si5351_load(SYNTH_MS_0, si5351_lo[sideband], si5351_ms_lo);
+	if(store)
+	{
+		persist_flush(); //Store new frequency for LO
+		show_msg((char*)"Stored.", LIGHTGREEN);
+	}
+	else
+	{
+		show_msg((char*)"Aborted.", LIGHTRED);
+	}	
+	msg_deadline = deadline(MSG_TIME);
+	show_frequency1(f_vfo[cur_band][cur_vfo], 2);
+	show_sideband(sideband, 0);
+}
+
+///////////////////////
+//   VFO TUNING      //     
+///////////////////////
+//Encoder evaluation, called from SysTick every 10ms: detents since last
+//call, weighted with the acceleration curve, are added to enc_hz
+void enc_scan(void)
+{
+	static int cnt_old = 0, rest = 0;
+	int cnt, d, t1, vel, hz = 1;
+	
+#ifdef ENC_HW_TIMER
+	cnt = (int16_t) TIM1->CNT;
+#else
+	cnt = enc_count;
+#endif
+	d = (int16_t) (cnt - cnt_old) + rest; //Counts
+	cnt_old = cnt;
+	rest = d % ENC_DIV;
+	d /= ENC_DIV;                         //Detents
+	
+	//Smoothed speed in detents/s * 16, step chosen by the speed before
+	//this sample so a single detent from rest stays on the first entry
+	vel = enc_vel >> 4;
+	enc_vel += ((d < 0 ? -d : d) * 100 * 16 - enc_vel) / ENC_VEL_FILTER;
+	
+	if(d)
+	{
+		for(t1 = 0; t1 < ENC_CURVE; t1++)
+		{
+			if(vel >= enc_curve[t1][0])
+			{
+				hz = enc_curve[t1][1];
+			}
+		}	
+#ifdef PROFILE
+		if(!enc_hz)
+		{
+			prof_enc_c0 = DWT->CYCCNT | 1;
+		}	
+#endif
+		atomic_add(&enc_hz, d * hz);
+	}
+}
+	
+//Take pending tuning offset in Hz, steps added meanwhile stay in enc_hz
+long enc_get(void)
+{
+	return (int32_t) atomic_xchg(&enc_hz, 0);
+}
+		
+//Apply encoder pulses to current VFO
+void tune_vfo(void)
+{
+	long f;
+	
+	if(enc_hz && page == PAGE_LO)    //LO being set
+	{
+		PROF_BEGIN();
+		lo_f += enc_get();
+		si5351_set_freq(SYNTH_MS_0, lo_f);
+		PROF_END(PRF_SI5351);
+		show_frequency1(lo_f, 2);
+		return;
+	}
+	
+	if(enc_hz)
+	{
+		if(scan_mode)
+		{
+			scan_stop();               //Tune on from where scan was
+		}
+		f = f_vfo[cur_band][cur_vfo] + enc_get();
+		f_vfo[cur_band][cur_vfo] = f;
+		if(page != PAGE_SCOPE)         //Sweep owns the DDS, recenters on next sweep
+		{
+			set_frequency(f);
+		}
+#ifdef PROFILE
+		prof_latency();
+#endif
+		show_frequency1(f_vfo[cur_band][cur_vfo], 2);
+		persist_touch();
+	}		
+}
+
+///////////////////////
+//   BAND RELAY SET  //     
+///////////////////////
+void set_band_relay(int b)
+{
+	GPIOA->BSRR = band_bsrr[b]; //All relay lines in one write
+    
+    //Set LO to preferred sideband of new ham band, only changed registers are sent
+    si5351_load(SYNTH_MS_0, si5351_lo[pref_sideband[b]], si5351_ms_lo);
+    show_sideband(pref_sideband[b], 0);
+}	
+
+//Precompute relay port words and LO registers, call after f_lo changed
+void band_prepare(void)
+{
+	int t0, t1;
+	
+	for(t0 = 0; t0 < MAXBANDS; t0++)
+	{
+		band_bsrr[t0] = 0;
+		for(t1 = 0; t1 < 3; t1++)
+		{
+			if((1 << t1) & t0)
+			{
+				band_bsrr[t0] |= (1 << (10 + t1));        //Set
+			}
+			else
+			{
+				band_bsrr[t0] |= (1 << (10 + t1 + 16));   //Reset
+			}
+		}
+	}
+	
+	//Divider for the higher LO fits both
+	si5351_msdiv = si5351_div((f_lo[1] > f_lo[0]) ? f_lo[1] : f_lo[0]);
+	for(t1 = 0; t1 < 2; t1++)
+	{
+		si5351_calc(f_lo[t1], si5351_msdiv, si5351_lo[t1], si5351_ms_lo);
+	}
+}
+
+//Switch sideband and LO
+void sideband_select(int sb)
+{
+	sideband = sb;
+	si5351_load(SYNTH_MS_0, si5351_lo[sb], si5351_ms_lo);
+	show_sideband(sb, 0);
+	persist_touch();
+}	
+
+void vfo_select(int v)
+{
+	cur_vfo = v;
+	set_frequency(f_vfo[cur_band][cur_vfo]);
+	show_vfo(cur_vfo, cur_band, 0);
+	show_frequency1(f_vfo[cur_band][cur_vfo], 2);
+	persist_touch();
+}	
+
+//Set frequency of VFO v, 0 if outside of all bands. Changes band only
+//for the current VFO, the other one is just stored in its band.
+int vfo_set_freq(int v, long f)
+{
+	int b;
+	
+	for(b = 0; b < MAXBANDS && !is_freq_ok(f, b); b++);
+	if(b == MAXBANDS)
+	{
+		return 0;
+	}
+	if(scan_mode)
+	{
+		scan_stop();
+	}	
+	
+	f_vfo[b][v] = f;
+	if(v == cur_vfo)
+	{
+		if(b != cur_band)
+		{
+			band_switch(b);
+		}
+		else
+		{
+			set_frequency(f);
+			show_frequency1(f, 2);
+		}
+	}
+	show_vfo(cur_vfo, cur_band, 0);
+	persist_touch();	
+	return 1;
+}	
+
+//Band change: RF path first (relays need longest to settle, LO then DDS,
+//both sent in background), display and EEPROM are deferred
+void band_switch(int b)
+{
+	cur_band = b;
+	sideband = pref_sideband[b];
+	set_band_relay(b);
+	set_frequency(f_vfo[b][cur_vfo]);
+	
+	show_frequency1(f_vfo[b][cur_vfo], 2);
+	show_band(b, 0);
+	persist_touch();
+}	
+
+  ///////////////////////
+ //   MEMORY & SCAN   //     
+///////////////////////
+//Register images of all channels, after load and DDS clock change
+void mem_prepare(void)
+{
+	int t1;
+	
+	for(t1 = 0; t1 < MEM_CHANNELS; t1++)
+	{
+		if(mem[t1].f)
+		{
+			mem[t1].ftw = dds_ftw(mem[t1].f + INTERFREQUENCY);
+			mem[t1].bsrr = band_bsrr[mem[t1].band];
+		}
+	}
+}	
+
+//All channels in one sequential read
+void mem_load(void)
+{
+	uint8_t buf[MEM_CHANNELS * MEM_RECSIZE], *r;
+	int t1;
+	
+	eeprom_read_seq(MEM_BASE, buf, MEM_CHANNELS * MEM_RECSIZE);
+	for(t1 = 0; t1 < MEM_CHANNELS; t1++)
+	{
+		r = buf + t1 * MEM_RECSIZE;
+		mem[t1].f = 0;
+		if(r[0] == MEM_MAGIC && r[1] < MAXBANDS && r[2] < 2 && is_freq_ok(eeprom_get_long(r + 4), r[1]))
+		{
+			mem[t1].f = eeprom_get_long(r + 4);
+			mem[t1].band = r[1];
+			mem[t1].sb = r[2];
+		}
+	}
+	mem_prepare();
+}
+
+//Store f in first free channel, or clear the channel that holds f
+//already. Returns channel number, -1 if all are in use.
+int mem_store(long f, int b, int sb)
+{
+	uint8_t r[MEM_RECSIZE];
+	int t1, ch = -1;
+	
+	for(t1 = 0; t1 < MEM_CHANNELS; t1++)
+	{
+		if(mem[t1].f == f)
+		{
+			mem[t1].f = 0;
+			eeprom_write(MEM_BASE + t1 * MEM_RECSIZE, 0xFF);
+			return t1;
+		}
+		if(!mem[t1].f && ch < 0)
+		{
+			ch = t1;
+		}	
+	}
+	if(ch < 0)
+	{
+		return -1;
+	}
+	
+	mem[ch].f = f;
+	mem[ch].band = b;
+	mem[ch].sb = sb;
+	r[0] = MEM_MAGIC;
+	r[1] = b;
+	r[2] = sb;
+	r[3] = 0;
+	eeprom_put_long(r + 4, f);
+	eeprom_write_page(MEM_BASE + ch * MEM_RECSIZE, r, MEM_RECSIZE);
+	mem_prepare();
+	return ch;
+}		
+
+//Hop to channel: relays, LO (only changed bytes) and DDS, no math
+void mem_push(struct mem_chan *m)
+{
+	GPIOA->BSRR = m->bsrr;
+	si5351_load(SYNTH_MS_0, si5351_lo[m->sb], si5351_ms_lo);
+	dds_write_ftw(m->ftw);
+}	
+
+//Start memory or band scan from current state
+void scan_start(int mode)
+{
+	int t1;
+	
+	if(scan_mode == SCAN_MEM)      //Last channel may be on other band/sideband
+	{
+		GPIOA->BSRR = band_bsrr[cur_band]; //Relays and LO as before, one LO load
+		si5351_load(SYNTH_MS_0, si5351_lo[sideband], si5351_ms_lo);
+		set_frequency(f_vfo[cur_band][cur_vfo]);
+		show_band(cur_band, 0);
+		show_sideband(sideband, 0);
+	}	
+	
+	scan_band = cur_band;
+	scan_sb = sideband;
+	scan_f = f_vfo[cur_band][cur_vfo];
+	scan_idx = -1;
+	if(mode == SCAN_MEM)
+	{
+		for(t1 = 0; t1 < MEM_CHANNELS && !mem[t1].f; t1++);
+		if(t1 == MEM_CHANNELS)
+		{
+			mode = SCAN_BAND; //Nothing stored
+		}	
+	}	
+	if(mode == SCAN_BAND)
+	{
+		scan_acc = (unsigned long long) (scan_f + INTERFREQUENCY) * dds_ftw_scale + 0x80000000ULL;
+	}	
+	
+	scan_mode = mode;
+	scan_hold = 0;
+	scan_deadline = deadline(0);
+	show_msg((char*)((mode == SCAN_MEM) ? "Scan memory" : "Scan band"), LIGHTYELLOW);
+	msg_deadline = 0;
+}	
+
+//Stop scan, current channel becomes the VFO frequency
+void scan_stop(void)
+{
+	scan_mode = SCAN_OFF;            //Relays, LO and DDS are already set by the last hop
+	cur_band = scan_band;
+	sideband = scan_sb;
+	f_vfo[cur_band][cur_vfo] = scan_f;
+	
+	show_band(cur_band, 0);
+	show_sideband(sideband, 0);
+	show_frequency1(scan_f, 2);
+	show_msg((char*)"DK7IH 8-Band-TRX", LIGHTBLUE);    
+	persist_touch();
+}	
+
+//After each dwell: hold while S-meter is above squelch (and SCAN_HANG
+//after), else hop to next channel
+void task_scan(void)
+{
+	int t1;
+	
+	if(!scan_mode || !expired(scan_deadline))
+	{
+		return;
+	}
+	if(get_txrx())
+	{
+		scan_stop();
+		return;
+	}	
+	scan_deadline = deadline(scan_dwell);
+	
+	if(get_sval() >= scan_squelch)
+	{
+		scan_hold = deadline(SCAN_HANG);
+		return;
+	}
+	if(scan_hold && !expired(scan_hold))
+	{
+		return;
+	}	
+	scan_hold = 0;
+	
+	if(scan_mode == SCAN_MEM)
+	{
+		for(t1 = 0; t1 < MEM_CHANNELS; t1++)
+		{
+			scan_idx = (scan_idx + 1) % MEM_CHANNELS;
+			if(mem[scan_idx].f)
+			{
+				break;
+			}
+		}		
+		mem_push(&mem[scan_idx]);
+		if(mem[scan_idx].band != scan_band)
+		{
+			show_band(mem[scan_idx].band, 0);
+		}
+		if(mem[scan_idx].sb != scan_sb)
+		{
+			show_sideband(mem[scan_idx].sb, 0);
+		}
+		scan_band = mem[scan_idx].band;
+		scan_sb = mem[scan_idx].sb;
+		scan_f = mem[scan_idx].f;
+	}
+	else
+	{
+		scan_f += scan_step;
+		scan_acc += (unsigned long long) scan_step * dds_ftw_scale;
+		if(scan_f > band_f1[scan_band])
+		{
+			scan_f = band_f0[scan_band];
+			scan_acc = (unsigned long long) (scan_f + INTERFREQUENCY) * dds_ftw_scale + 0x80000000ULL;
+		}	
+		dds_write_ftw(scan_acc >> 32);
+	}	
+	show_frequency1(scan_f, 2);
+}		
+
+  ///////////////////////
+ //   CAT             //     
+///////////////////////
+//USART1 with DMA2 stream 2 ch4 (RX, circular) and stream 7 ch4 (TX),
+//polled from the scheduler, no interrupt per byte
+void cat_init(void)
+{
+	RCC->AHB1ENR |= (1 << 0) | (1 << 1) | (1 << 22); //GPIOA, GPIOB, DMA2
+	RCC->APB2ENR |= (1 << 4);                        //USART1 clock enable
+	
+	//PA15 AF7 (TX), PB7 AF7 (RX, pullup)
+	GPIOA->MODER &= ~(3 << (15 << 1));
+	GPIOA->MODER |= (2 << (15 << 1));
+	GPIOA->AFR[1] &= ~(0x0F << ((15 - 8) << 2));
+	GPIOA->AFR[1] |= (7 << ((15 - 8) << 2));
+	GPIOB->MODER &= ~(3 << (7 << 1));
+	GPIOB->MODER |= (2 << (7 << 1));
+	GPIOB->PUPDR |= (1 << (7 << 1));
+	GPIOB->AFR[0] &= ~(0x0F << (7 << 2));
+	GPIOB->AFR[0] |= (7 << (7 << 2));
+	
+	USART1->BRR = (clk_pclk2 + CAT_BAUD / 2) / CAT_BAUD; //Oversampling by 16
+	USART1->CR3 = (1 << 7) | (1 << 6);               //DMAT, DMAR
+	USART1->CR1 = (1 << 13) | (1 << 3) | (1 << 2);   //UE, TE, RE
+	
+	//RX: DMA2 stream 2 channel 4, circular into cat_rx
+	DMA2_Stream2->CR = 0;
+	while(DMA2_Stream2->CR & 1);
+	DMA2->LIFCR = (0x3D << 16);                      //Clear all flags of stream 2
+	DMA2_Stream2->PAR = (uint32_t) &USART1->DR;
+	DMA2_Stream2->M0AR = (uint32_t) cat_rx;
+	DMA2_Stream2->NDTR = CAT_RXBUF;
+	DMA2_Stream2->CR = (4 << 25)                     //Channel 4: USART1_RX
+	                 | (1 << 10)                     //MINC, 8 bit
+	                 | (1 << 8);                     //CIRC, periph. to memory
+	DMA2_Stream2->CR |= 1;
+}	
+
+//Put reply byte into TX ring, dropped if full
+void cat_putc(char c)
+{
+	int next = (cat_tx_head + 1) % CAT_TXBUF;
+	
+	if(next != cat_tx_tail)
+	{
+		cat_tx[cat_tx_head] = c;
+		cat_tx_head = next;
+	}
+}	
+
+void cat_puts(const char *str)
+{
+	while(*str)
+	{
+		cat_putc(*str++);
+	}
+}		
+
+//Number with leading zeros, digits wide
+void cat_putnum(long num, int digits)
+{
+	char buf[12];
+	int t1;
+	
+	for(t1 = digits - 1; t1 >= 0; t1--)
+	{
+		buf[t1] = '0' + num % 10;
+		num /= 10;
+	}
+	for(t1 = 0; t1 < digits; t1++)
+	{
+		cat_putc(buf[t1]);
+	}
+}	
+
+//Start DMA for next contiguous part of TX ring when previous one is done
+void cat_flush(void)
+{
+	if(cat_tx_len)
+	{
+		if(!(DMA2->HISR & (1 << 27)))            //TCIF7
+		{
+			return;
+		}
+		DMA2->HIFCR = (0x3D << 22);              //Clear all flags of stream 7
+		cat_tx_tail = (cat_tx_tail + cat_tx_len) % CAT_TXBUF;
+		cat_tx_len = 0;
+	}
+	
+	if(cat_tx_tail == cat_tx_head)
+	{
+		return;
+	}
+	cat_tx_len = (cat_tx_head > cat_tx_tail) ? cat_tx_head - cat_tx_tail : CAT_TXBUF - cat_tx_tail;
+	
+	DMA2_Stream7->CR = 0;
+	while(DMA2_Stream7->CR & 1);
+	DMA2->HIFCR = (0x3D << 22);
+	DMA2_Stream7->PAR = (uint32_t) &USART1->DR;
+	DMA2_Stream7->M0AR = (uint32_t) (cat_tx + cat_tx_tail);
+	DMA2_Stream7->NDTR = cat_tx_len;
+	DMA2_Stream7->CR = (4 << 25)                 //Channel 4: USART1_TX
+	                 | (1 << 10)                 //MINC, 8 bit
+	                 | (1 << 6);                 //Memory to peripheral
+	USART1->SR &= ~(1 << 6);                     //Clear TC
+	DMA2_Stream7->CR |= 1;
+}		
+
+//Execute one command (without ';'), set commands act like keys/encoder
+void cat_exec(char *cmd, int len)
+{
+	long f = 0;
+	int t1, v;
+	
+	if(len < 2)
+	{
+		return;
+	}
+	
+	for(t1 = 2; t1 < len; t1++)
+	{
+		if(cmd[t1] < '0' || cmd[t1] > '9' || f > CAT_NUM_MAX / 10) //Next digit would overflow
+		{
+			cat_puts("?;");
+			return;
+		}
+		f = f * 10 + cmd[t1] - '0';
+	}
+	
+	if((cmd[0] == 'F') && (cmd[1] == 'A' || cmd[1] == 'B')) //VFO frequency
+	{
+		v = cmd[1] - 'A';
+		if(len > 2 && !vfo_set_freq(v, f))
+		{
+			cat_puts("?;");
+			return;
+		}
+		cat_putc('F');
+		cat_putc(cmd[1]);
+		cat_putnum((len > 2) ? f : f_vfo[cur_band][v], 11);
+		cat_putc(';');
+		return;
+	}	
+	
+	if((cmd[0] == 'F') && (cmd[1] == 'R' || cmd[1] == 'T')) //RX/TX VFO (no split: both)
+	{
+		if(len > 2 && f < 2 && f != cur_vfo)
+		{
+			vfo_select(f);
+		}
+		cat_putc('F');
+		cat_putc(cmd[1]);
+		cat_putnum(cur_vfo, 1);
+		cat_putc(';');
+		return;
+	}	
+	
+	if((cmd[0] == 'M') && (cmd[1] == 'D')) //Mode: 1 LSB, 2 USB
+	{
+		if(len > 2 && (f == 1 || f == 2) && (f - 1 != sideband))
+		{
+			sideband_select(f - 1);
+		}
+		cat_puts("MD");
+		cat_putnum(sideband + 1, 1);
+		cat_putc(';');
+		return;
+	}	
+	
+	if((cmd[0] == 'I') && (cmd[1] == 'F') && (len == 2)) //Status
+	{
+		cat_puts("IF");
+		cat_putnum(f_vfo[cur_band][cur_vfo], 11);
+		cat_puts("     +000000000");            //Step, RIT/XIT offset and flags, memory channel
+		cat_putnum(!get_txrx(), 1);             //TX
+		cat_putnum(sideband + 1, 1);            //Mode
+		cat_putnum(cur_vfo, 1);
+		cat_puts("000000;");                    //Scan, split, tone, tone no., shift
+		return;
+	}	
+	
+	if((cmd[0] == 'C') && (cmd[1] == 'L') && (len > 2)) //Not Kenwood: DDS output measured in Hz
+	{
+		dds_calibrate(f_vfo[cur_band][cur_vfo] + INTERFREQUENCY, f);
+		set_frequency(f_vfo[cur_band][cur_vfo]);
+		cat_puts("CL");
+		cat_putnum(dds_clock, 9);
+		cat_putc(';');
+		return;
+	}	
+	
+	if((cmd[0] == 'I') && (cmd[1] == 'D') && (len == 2))
+	{
+		cat_puts("ID020;");                     //Reported as TS-480
+		return;
+	}	
+	
+	cat_puts("?;");
+}	
+
+//Parse received bytes up to DMA write position
+void task_cat(void)
+{
+	int wpos = CAT_RXBUF - DMA2_Stream2->NDTR;
+	char c;
+	
+	if(wpos == CAT_RXBUF)
+	{
+		wpos = 0;
+	}
+		
+	while(cat_rx_pos != wpos)
+	{
+		c = cat_rx[cat_rx_pos];
+		cat_rx_pos = (cat_rx_pos + 1) % CAT_RXBUF;
+		
+		if(c == ';')
+		{
+			cat_exec(cat_cmd, cat_cmd_len);
+			cat_cmd_len = 0;
+		}
+		else if(c > ' ' && cat_cmd_len < CAT_CMDLEN)
+		{
+			cat_cmd[cat_cmd_len++] = (c >= 'a' && c <= 'z') ? c - 32 : c;
+		}	
+	}
+	cat_flush();
+}	
+
+#ifdef PROFILE
+///////////////////////
+//   PROFILING       //     
+///////////////////////
+//Accumulate one measurement (cycles) of probe id
+void prof_add(int id, unsigned long cycles)
+{
+	struct prof_probe *pp = &prof[id];
+	
+	if(!pp->n || cycles < pp->min)
+	{
+		pp->min = cycles;
+	}
+	if(cycles > pp->max)
+	{
+		pp->max = cycles;
+	}
+	pp->sum += cycles;
+	pp->n++;
+}
+
+//Time from first detent to new tuning word into histogram
+void prof_latency(void)
+{
+	unsigned long us;
+	int bin = 0;
+	
+	if(!prof_enc_c0)
+	{
+		return;
+	}
+	us = (DWT->CYCCNT - prof_enc_c0) / (clk_hclk / 1000000);
+	prof_enc_c0 = 0;
+	
+	for(us /= 250; us && bin < PRF_LATBINS - 1; us >>= 1)
+	{
+		bin++;
+	}
+	prof_lat[bin]++;
+}
+	
+//Diagnostic page: min/avg/max in us per probe, latency histogram in %.
+//Open it here, task_prof() updates it, any key returns to main screen.
+void prof_page(void)
+{
+	page = PAGE_PROF;
+	lcd_cls0(backcolor);
+	lcd_putstring(0, PRF_ROW(0), (char*)"us  min avg  max", LIGHTBLUE, backcolor, 1, 1);
+	lcd_putstring(0, PRF_ROW(6), (char*)"Lat %    Idle", LIGHTBLUE, backcolor, 1, 1);
+	task_prof();
+}
+
+//Refresh values of diagnostic page (500ms)
+void task_prof(void)
+{
+	int t1, row, y;
+	unsigned long n;
+	
+	if(page != PAGE_PROF)
+	{
+		return;
+	}
+	
+	y = PRF_ROW(6);
+	lcd_cls1(calc_xpos(13), y + 2, 129, y + FONTHEIGHT, backcolor);
+	lcd_putnumber(calc_xpos(13), y, prof_idle_pct, -1, YELLOW, backcolor, 1, 1);
+	
+	for(t1 = 0; t1 < PRF_PROBES; t1++)
+	{
+		y = PRF_ROW(t1 + 1);
+		lcd_cls1(0, y + 2, 129, y + FONTHEIGHT, backcolor);
+		lcd_putstring(0, y, (char*)prof[t1].name, WHITE, backcolor, 1, 1);
+		if(prof[t1].n)
+		{
+			lcd_putnumber(calc_xpos(3), y, prof[t1].min / (clk_hclk / 1000000), -1, YELLOW, backcolor, 1, 1);
+			lcd_putnumber(calc_xpos(7), y, (prof[t1].sum / prof[t1].n) / (clk_hclk / 1000000), -1, YELLOW, backcolor, 1, 1);
+			lcd_putnumber(calc_xpos(11), y, prof[t1].max / (clk_hclk / 1000000), -1, YELLOW, backcolor, 1, 1);
+		}
+	}
+	
+	for(n = 0, t1 = 0; t1 < PRF_LATBINS; t1++)
+	{
+		n += prof_lat[t1];
+	}	
+	for(row = 0; row < 2; row++)
+	{
+		y = PRF_ROW(row + 7);
+		lcd_cls1(0, y + 2, 129, y + FONTHEIGHT, backcolor);
+		for(t1 = 0; t1 < PRF_LATBINS / 2; t1++)
+		{
+			lcd_putnumber(calc_xpos(t1 * 4), y, n ? prof_lat[row * PRF_LATBINS / 2 + t1] * 100 / n : 0, -1, YELLOW, backcolor, 1, 1);
+		}
+	}		
+	
+	//kBytes on LCD, I2C and DDS bus
+	y = PRF_ROW(9);
+	lcd_cls1(0, y + 2, 129, y + FONTHEIGHT, backcolor);
+	lcd_putstring(0, y, (char*)"L", WHITE, backcolor, 1, 1);
+	lcd_putnumber(calc_xpos(1), y, io_stat.lcd >> 10, -1, YELLOW, backcolor, 1, 1);
+	lcd_putstring(calc_xpos(6), y, (char*)"I", WHITE, backcolor, 1, 1);
+	lcd_putnumber(calc_xpos(7), y, io_stat.i2c >> 10, -1, YELLOW, backcolor, 1, 1);
+	lcd_putstring(calc_xpos(11), y, (char*)"D", WHITE, backcolor, 1, 1);
+	lcd_putnumber(calc_xpos(12), y, io_stat.dds >> 10, -1, YELLOW, backcolor, 1, 1);
+}	
+#endif
+
+///////////////////////
+//   BAND SCOPE      //     
+///////////////////////
+//Draw column x: spectrum bar for level sv (0..255) and waterfall history.
+//Sent as one 1 px wide window, DMA runs while the next step settles.
+void scope_column(int x, int sv)
+{
+	int y, h = sv * SCOPE_SPECH >> 8;
+	uint16_t bg = (x == SCOPE_W / 2) ? GRAY : backcolor; //Center mark
+	
+	lcd_wait();                        //Previous column still in transfer
+	for(y = 0; y < SCOPE_SPECH; y++)
+	{
+		scope_col[y] = (y < SCOPE_SPECH - h) ? bg : LIGHTGREEN;
+	}
+	for(y = 0; y < SCOPE_WFH; y++)
+	{
+		scope_col[SCOPE_SPECH + y] = scope_pal[scope_wf[(scope_wftop + y) % SCOPE_WFH][x] >> 5];
+	}
+	lcd_blit(x, SCOPE_SPECY, 1, SCOPE_SPECH + SCOPE_WFH, scope_col);
+}	
+
+//Open band scope around current VFO. Keys 0/3 change the step, other
+//keys or TX return to main screen (task_keys(), task_scope()).
+void scope_page(void)
+{
+	page = PAGE_SCOPE;
+	scope_x = 0;
+	scope_redraw = 1;
+	lcd_cls1(0, SCOPE_Y0, 131, 131, backcolor);
+}
+
+//Idle task: one sweep step when settled. Pipelined: after the settle
+//time the MTR value is latched and the next FTW is sent at once, so the
+//next step settles while this one is stored and drawn.
+void task_scope(void)
+{
+	int x = scope_x;
+	long fc = f_vfo[cur_band][cur_vfo];
+	
+	if(page != PAGE_SCOPE)
+	{
+		return;
+	}
+	if(get_txrx())
+	{
+		page_close();
+		return;
+	}	
+	
+	if(x == 0 && (scope_redraw || fc != scope_fc)) //New center or step: from next sweep on
+	{
+		scope_fc = fc;
+		scope_step_hz = scope_step[scope_stepidx];
+		scope_f0 = fc - (long) scope_step_hz * (SCOPE_W / 2);
+		lcd_cls1(0, SCOPE_Y0, 129, SCOPE_SPECY - 1, backcolor);
+		lcd_putnumber(0, SCOPE_Y0, fc / 100, 1, WHITE, backcolor, 1, 1);
+		lcd_putnumber(calc_xpos(9), SCOPE_Y0, scope_step_hz, -1, YELLOW, backcolor, 1, 1);
+		lcd_putstring(calc_xpos(13), SCOPE_Y0, (char*)"Hz", YELLOW, backcolor, 1, 1);
+		set_frequency(scope_f0);
+		scope_t = micros();
+		scope_redraw = 0;
+		return;
+	}	
+	
+	if(micros() - scope_t < SCOPE_SETTLE)
+	{
+		return;
+	}	
+	
+	scope_wf[scope_wftop][x] = get_sval();
+	if(x < SCOPE_W - 1)
+	{
+		set_frequency(scope_f0 + (long) scope_step_hz * (x + 1));
+	}
+	else if(!scope_redraw && fc == scope_fc)
+	{
+		set_frequency(scope_f0);       //Next sweep, same parameters
+	}	
+	scope_t = micros();
+	
+	scope_column(x, scope_wf[scope_wftop][x]);
+	if(++x == SCOPE_W)
+	{
+		x = 0;
+		scope_wftop = (scope_wftop + SCOPE_WFH - 1) % SCOPE_WFH; //Scroll down one line
+	}
+	scope_x = x;
+}
+
+///////////////////////
+//   SCHEDULER       //     
+///////////////////////
+//Back to main screen from any page
+void page_close(void)
+{
+	if(page == PAGE_SCOPE)
+	{
+		set_frequency(f_vfo[cur_band][cur_vfo]); //DDS back from sweep
+	}
+	page = PAGE_MAIN;
+	redraw_screen();
+}	
+
+//Key handling of main screen
+void task_keys(void)
+{
+	int key = get_keys();
+	int t1;
+    
+    if(page == PAGE_LO)                //Only keys 6 (abort) and 7 (store)
+    {
+		if(key == 6 || key == 7)
+		{
+			lo_close(key == 7);
+		}
+		return;
+	}	
+	
+    if(page == PAGE_PROF && key != -1) //Any key closes diagnostic page
+    {
+		page_close();
+		return;
+	}	
+	
+    if(page == PAGE_SCOPE && key != -1) //Keys 0/3: step up/down, others close scope
+    {
+		if(key == 0 && scope_stepidx < SCOPE_STEPS - 1)
+		{
+			scope_stepidx++;
+			scope_redraw = 1;
+		}
+		else if(key == 3 && scope_stepidx > 0)
+		{
+			scope_stepidx--;
+			scope_redraw = 1;
+		}
+		else if(key != 0 && key != 3)
+		{
+			page_close();
+		}
+		return;
+	}	
+	
+    if(scan_mode && key != -1) //Key 5 switches scan type, others stop
+    {
+		if(key == 5 && scan_mode == SCAN_MEM)
+		{
+			scan_start(SCAN_BAND);
+		}
+		else
+		{
+			scan_stop();
+		}
+		return;
+	}		
+        
+    switch(key)
+    {
+		case 0: if(cur_band < (MAXBANDS - 1))
+		        {
+					band_switch(cur_band + 1);
+				}
+				break;
+				
+		case 1: sideband_select(!sideband);
+		        break;
+		        
+		case 2: vfo_select(!cur_vfo);
+				break;        
+				
+		case 3: if(cur_band > 0)
+		        {
+					band_switch(cur_band - 1);
+				}		
+				break;
+				
+		case 4: persist_flush();
+		        show_msg((char*)"Saved.", LIGHTGREEN);
+		        msg_deadline = deadline(MSG_TIME);
+		        break;		
+		        
+		case 5: scan_start(SCAN_MEM);
+		        break;		
+		        
+		case 6: set_lo(0);
+		        break;    
+		          
+		case 7: set_lo(1);
+		        break;        
+#ifdef PROFILE
+		case 8: prof_page();
+		        break;        
+#endif
+		case 9: t1 = (clk_cur + 1) % CLK_PROFILES; //Next clock profile
+		        if(clk_apply(t1))
+		        {
+					show_msg((char*)clk_profile[t1].name, LIGHTGREEN);
+				}
+				else
+				{
+					show_msg((char*)"CLK invalid", LIGHTRED);
+				}	
+		        msg_deadline = deadline(MSG_TIME);
+		        break;        
+		        
+		case 10: scope_page();
+		        break;        
+		        
+		case 11: t1 = mem_store(f_vfo[cur_band][cur_vfo], cur_band, sideband);
+		        if(t1 < 0)
+		        {
+					show_msg((char*)"Memory full", LIGHTRED);
+				}
+				else
+				{	
+					rq_post(RQ_MSG, t1, LIGHTGREEN, 0, mem[t1].f ? "Stored M" : "Cleared M");
+				}	
+		        msg_deadline = deadline(MSG_TIME);
+		        break;        
+	}	
 }
 
-void i2c_stop(void) 
+void task_meter(void)
 {
-    I2C1->CR1 |= I2C_CR1_STOP;
-    while(!(I2C1->SR2 & I2C_SR2_BUSY));
+	show_meter(get_sval());
 }
 
-void i2c_write_byte1(uint8_t regaddr, uint8_t data, int i2c_adr) 
+//Clear message line
+void task_msg(void)
 {
-    //Start signal
-    i2c_start();
-
-    //Send chipaddr to be targeted
-    I2C1->DR = i2c_adr;
-    while(!(I2C1->SR1 & I2C_SR1_ADDR)); //Wait until transfer done
-    //Perform one dummy read to clear register flags etc.
-    (void)I2C1->SR2; //Clear addr reg
-
-    //Send operation type/register 
-    I2C1->DR = regaddr;
-    while(!(I2C1->SR1 & I2C_SR1_BTF)); //Wait until transfer done
-
-    //Send data
-    I2C1->DR = data;
-    while(!(I2C1->SR1 & I2C_SR1_BTF));  //Wait
-
-    //Send stop signal
-    i2c_stop();
+	if(msg_deadline && expired(msg_deadline))
+	{
+		show_msg((char*)"DK7IH 8-Band-TRX", LIGHTBLUE);    
+		msg_deadline = 0;		
+	}	
 }
 
-//Write multiple number of bytes (>1)
-void i2c_write_byte2(uint8_t *data, uint8_t n, int i2c_adr) 
+void task_txrx(void)
 {
-	int t1 = 0;
-	    
-    //Send start signal
-    i2c_start();
-
-    //Send device address
-    I2C1->DR = i2c_adr; 
-    while (!(I2C1->SR1 & I2C_SR1_ADDR));
-    //Perform one dummy read to clear flags
-    (void)I2C1->SR2;
-
-    for(t1 = 0; t1 < n; t1++)
+	static int tx_stat_old = 0;
+	
+    if(get_txrx() != tx_stat_old)
     {
-		//Send data
-        I2C1->DR = data[t1];
-        while (!(I2C1->SR1 & I2C_SR1_BTF));
+        show_txrx();
+        tx_stat_old = get_txrx();
     }    
-    
-    //Send stop signal
-    i2c_stop();
-}
-
-int16_t i2c_read(uint8_t regaddr, int i2c_adr) 
-{
-    int16_t reg;
-
-    //Start communication
-    i2c_start();
-
-    //Send device address
-    I2C1->DR = i2c_adr;
-    while (!(I2C1->SR1 & I2C_SR1_ADDR));
-    //Dummy read to clear flags
-    (void)I2C1->SR2; //Clear addr register
-
-    //Send operation type/register 
-    I2C1->DR = regaddr;
-    while (!(I2C1->SR1 & I2C_SR1_BTF));
-
-    //Restart by sending stop & start sig
-    i2c_stop();
-    i2c_start();
-
-    //Repeat
-    I2C1->DR = i2c_adr | 0x01; // read
-    while (!(I2C1->SR1 & I2C_SR1_ADDR));
-    (void)I2C1->SR2;
-
-    //Wait until data arrived in receive buffer
-    while (!(I2C1->SR1 & I2C_SR1_RXNE));
-    //Read value
-    reg = (uint8_t)I2C1->DR;
-
-    //Send stop signal
-    i2c_stop();
-
-    return reg;
-}
-
-
-int16_t i2c_read2(uint16_t regaddr, int i2c_adr) 
-{
-    int16_t reg;
-    int16_t r_msb, r_lsb;
-    
-    r_msb = (regaddr & 0xFF00) >> 8;
-    r_lsb = regaddr & 0x00FF;
-
-    //Start communication
-    i2c_start();
-
-    //Send device address
-    I2C1->DR = i2c_adr;
-    while (!(I2C1->SR1 & I2C_SR1_ADDR));
-    //Dummy read to clear flags
-    (void)I2C1->SR2; //Clear addr register
-
-    //Send operation type/register MSB
-    I2C1->DR = r_msb;
-    while (!(I2C1->SR1 & I2C_SR1_BTF));
-
-    //Send operation type/register LSB
-    I2C1->DR = r_lsb;
-    while (!(I2C1->SR1 & I2C_SR1_BTF));
-
-    //Restart by sending stop & start sig
-    i2c_stop();
-    i2c_start();
-
-    //Repeat
-    I2C1->DR = i2c_adr | 0x01; // read
-    while (!(I2C1->SR1 & I2C_SR1_ADDR));
-    (void)I2C1->SR2;
-
-    //Wait until data arrived in receive buffer
-    while (!(I2C1->SR1 & I2C_SR1_RXNE));
-    //Read value
-    reg = (uint8_t)I2C1->DR;
-
-    //Send stop signal
-    i2c_stop();
-
-    return reg;
-}
-
-  //////////////////////
- // Si5351A commands //
-//////////////////////
-//Set PLLA (VCO) to internal clock rate of 900 MHz
-//In this example PLLB is not used
-//Equation fVCO = fXTAL * (a+b/c) => see AN619 p.3
-void si5351_start(void)
-{
-  unsigned long a, b, c;
-  unsigned long p1, p2;
-    
-  //Init
-  i2c_write_byte1(PLLX_SRC, 0, SI5351_ADR);              //Select XTAL as clock source for si5351C
-  i2c_write_byte1(SPREAD_SPECTRUM_PARAMETERS, 0, SI5351_ADR); //Spread spectrum diasble (Si5351 A or B only!
-  i2c_write_byte1(XTAL_LOAD_CAP, 0xD2, SI5351_ADR);      // Set crystal load capacitor to 10pF (default), 
-                                       // for bits 5:0 see also AN619 p. 60
-  i2c_write_byte1(CLK_ENABLE_CONTROL, 0x00, SI5351_ADR); // Enable all outputs
-  i2c_write_byte1(CLK0_CONTROL, 0x0E, SI5351_ADR);       // Set PLLA to CLK0, 8 mA output
-  i2c_write_byte1(CLK1_CONTROL, 0x0E, SI5351_ADR);       // Set PLLA to CLK1, 8 mA output
-  i2c_write_byte1(CLK2_CONTROL, 0x0E, SI5351_ADR);       // Set PLLA to CLK2, 8 mA output
-  i2c_write_byte1(PLL_RESET, (1 << 5), SI5351_ADR);          // Reset PLLA and PLLB
-
-  //Set VCO of PLLA to 864MHz
-  a = PLLRATIO;     // Division factor 864/27 MHz
-  b = 0;            // Numerator, sets b/c=0, See AN169 p.3!
-  c = 0xFFFFF;      // Max. resolution, but irrelevant in this case as b=0. See AN169 p.3!
-
-  //Formula for splitting up the numbers to register data, see AN619
-  p1 = 128 * a + (unsigned long) floor(128 * b / c) - 512;
-  p2 = 128 * b - c * (unsigned long) floor(128 * b / c);
-    
-  //Write data to registers of PLLA so that VCO is set to 864MHz internal freq
-  i2c_write_byte1(SYNTH_PLL_A, 0xFF, SI5351_ADR);
-  i2c_write_byte1(SYNTH_PLL_A + 1, 0xFF, SI5351_ADR);
-  i2c_write_byte1(SYNTH_PLL_A + 2, (p1 & 0x00030000) >> 16, SI5351_ADR);
-  i2c_write_byte1(SYNTH_PLL_A + 3, (p1 & 0x0000FF00) >> 8, SI5351_ADR);
-  i2c_write_byte1(SYNTH_PLL_A + 4, (p1 & 0x000000FF), SI5351_ADR);
-  i2c_write_byte1(SYNTH_PLL_A + 5, 0xF0 | ((p2 & 0x000F0000) >> 16), SI5351_ADR);
-  i2c_write_byte1(SYNTH_PLL_A + 6, (p2 & 0x0000FF00) >> 8, SI5351_ADR);
-  i2c_write_byte1(SYNTH_PLL_A + 7, (p2 & 0x000000FF), SI5351_ADR);
-
-}
-
-void si5351_set_freq(int synth, long freq)
-{
-  unsigned long  a, b, c = 0xFFFFF; 
-  unsigned long f_xtal = FXTAL;
-  double fdiv = (double) (f_xtal * PLLRATIO) / freq; //division factor fvco/freq (will be integer part of a+b/c)
-  double rm; //remaining
-  long p1, p2, p3;
-  
-  a = (unsigned long) fdiv;
-  rm = fdiv - a;  //(equiv. to fractional part b/c)
-  b = (unsigned long) (rm * c);
-  p1  = 128 * a + (unsigned long) floor(128 * b / c) - 512;
-  p2 = 128 * b - c * (unsigned long) floor(128 * b / c);
-  p3 = c;
-      
-  //Write data to multisynth registers of synth
-  i2c_write_byte1(synth + 0, (p3 & 0xFF00) >> 8, SI5351_ADR);  
-  i2c_write_byte1(synth + 1, p3 &  0xFF, SI5351_ADR);      
-  i2c_write_byte1(synth + 2, (p1 >> 16) & 0x03, SI5351_ADR);
-  i2c_write_byte1(synth + 3, (p1 & 0xFF00) >> 8, SI5351_ADR);
-  i2c_write_byte1(synth + 4, (p1 & 0xFF), SI5351_ADR);
-  i2c_write_byte1(synth + 5, (p3 & 0xF0) | ((p2 >> 16) & 0x0F), SI5351_ADR);
-  i2c_write_byte1(synth + 6, (p2 & 0x0000FF00) >> 8, SI5351_ADR);
-  i2c_write_byte1(synth + 7, (p2 & 0x000000FF), SI5351_ADR);
 }
 
-
-  ///////////////////////////
- //   EEPROM 24C65        //
-///////////////////////////
-void eeprom_write(uint16_t mem_address, uint8_t value)
-{
-   uint8_t data[3]; 
-   data[0] = mem_address >> 8;   //Address of byte in 24C65 MSB
-   data[1] = mem_address & 0xFF; //                         LSB
-   data[2] = value;
-   i2c_write_byte2(data, 3, EEPROM_ADR);
-   delay(5);
-}	
-
-uint8_t eeprom_read(uint16_t mem_address)
-{
-   uint8_t r = i2c_read2(mem_address, EEPROM_ADR);
-   delay(5);
-   
-   return r;
-}	
-  ////////////////////////////////////
- //   EEPROM & Mem functions       //
-////////////////////////////////////
-//Check if freq is in respective band
-int is_freq_ok(long f, int cband)
+//Filter VDD, PATMP, show them when they left the displayed value by
+//more than half a step plus hysteresis, alert on limits
+void task_telemetry(void)
 {
+	int v, t;
 	
-	if(f >= band_f0[cband] && f <= band_f1[cband])
+	tel_update();
+	
+	v = tel_vdd100();
+	if(tel_vdd_shown < 0 || v < tel_vdd_shown * 10 - 5 - TEL_VDD_HYST || v > tel_vdd_shown * 10 + 5 + TEL_VDD_HYST)
 	{
-	    return 1;
+		tel_vdd_shown = (v + 5) / 10;
+		show_voltage(tel_vdd_shown);
+	}
+	
+	t = tel_tmp10();
+	if(t < tel_tmp_shown * 10 - 5 - TEL_TMP_HYST || t > tel_tmp_shown * 10 + 5 + TEL_TMP_HYST)
+	{
+		tel_tmp_shown = get_pa_temp();
+		show_pa_temp(tel_tmp_shown);
+	}	
+	
+	if(expired(tel_alert_next))
+	{
+		if(t >= TEL_PA_ALERT * 10)
+		{
+			show_msg((char*)"PA TEMP HIGH", LIGHTRED);
+		}
+		else if(tel_vdd_shown < TEL_VDD_LOW)
+		{
+			show_msg((char*)"VDD LOW", LIGHTRED);
+		}
+		else
+		{
+			return;
+		}	
+		msg_deadline = deadline(MSG_TIME);
+		tel_alert_next = deadline(TEL_ALERT_REPEAT);
 	}	
-	return 0;		
-}
-
-long eeprom_load_frequency(int band, int vfo)
-{
-    long rf;
-    unsigned char hmsb, lmsb, hlsb, llsb;
-    int start_adr = vfo * 4 + band * 8 + 128;
-		
-    hmsb = eeprom_read(start_adr);
-    delay(2);
-    hlsb = eeprom_read(start_adr + 1);
-    delay(2);
-    lmsb = eeprom_read(start_adr + 2);
-    delay(2);
-    llsb = eeprom_read(start_adr + 3);
-    		
-    rf = (long) 16777216 * hmsb + (long) 65536 * hlsb + (unsigned int) 256 * lmsb + llsb;
-		
-	return rf;
 }
 
-void eeprom_store_frequency(int band, int vfo, long f)
+//Main screen regions only while main screen is up, full screen pages
+//draw directly
+void task_render(void)
 {
-    long hiword, loword;
-    unsigned char hmsb, lmsb, hlsb, llsb;
-	
-    int start_adr = vfo * 4 + band * 8 + 128;
-    	
-    hiword = f >> 16;
-    loword = f - (hiword << 16);
-    hmsb = hiword >> 8;
-    hlsb = hiword - (hmsb << 8);
-    lmsb = loword >> 8;
-    llsb = loword - (lmsb << 8);
-
-    eeprom_write(start_adr, hmsb);
-    eeprom_write(start_adr + 1, hlsb);
-    eeprom_write(start_adr + 2, lmsb);
-    eeprom_write(start_adr + 3, llsb);
+	if(page >= PAGE_FULL)
+	{
+#ifdef LCD_FRAMEBUFFER
+		lcd_fb_flush();
+#endif
+		return;
+	}
+	render_poll();
 }
-
-void save_all_vfos(void)
+			
+//Task table: period in ms, priority 0 is highest. Period 0 tasks
+//run only when nothing else is due.
+struct sched_task task[] = {{tune_vfo,       SCHED_TUNE,      0, 0},
+                            {task_keys,      10,              1, 0},
+                            {task_txrx,      20,              1, 0},
+                            {task_cat,       5,               1, 0},
+                            {task_scan,      1,               1, 0},
+                            {task_render,    1,               2, 0},
+                            {task_meter,     40,              2, 0},
+                            {task_msg,       100,             3, 0},
+                            {task_telemetry, TEL_PERIOD,      3, 0},
+#ifdef PROFILE
+                            {task_prof,      500,             3, 0},
+#endif
+                            {task_scope,     0,               4, 0},
+                            {persist_poll,   0,               4, 0}};
+#define TASKS ((int) (sizeof(task) / sizeof(task[0])))
+
+void sched_init(void)
 {
-	int t0, t1;
+	int t1;
 	
-	for(t0 = 0; t0 < MAXBANDS; t0++)
+	for(t1 = 0; t1 < TASKS; t1++)
 	{
-		for(t1 = 0; t1 < 2; t1++)
-		{
-			eeprom_store_frequency(t0, t1, f_vfo[t0][t1]);
-		}
+		task[t1].next = ms_ticks + t1; //Spread first calls
 	}
-	eeprom_write(257, cur_vfo); //Last VFO in use
-}			
+	
+}	
 
-void load_all_vfos(void)
+//Run the due task with highest priority, idle tasks or sleep
+void sched_run(void)
 {
-	int t0, t1;
+	int t1, sel = -1;
+	unsigned long now = ms_ticks;
 	
-	for(t0 = 0; t0 < MAXBANDS; t0++)
+	for(t1 = 0; t1 < TASKS; t1++)
 	{
-		for(t1 = 0; t1 < 2; t1++)
+		if(task[t1].period && ((long) (now - task[t1].next) >= 0))
 		{
-			f_vfo[t0][t1] = eeprom_load_frequency(t0, t1);
-			if(!is_freq_ok(f_vfo[t0][t1], t0))
+			if((sel < 0) || (task[t1].prio < task[sel].prio))
 			{
-				f_vfo[t0][t1] = f_vfo0[t0][t1];
-			}	 
-		}
+				sel = t1;
+			}
+		}	
 	}
-}			
-
-///////////////////////
-//      LO SET       //     
-///////////////////////
-int set_lo(int sb)
-{
-	long f_lo_tmp = f_lo[sb]; //LSB=0, USB=1
-	int key;
-		
-	show_sideband(sb, 1);
-	show_frequency1(0, 2);
-	show_frequency1(f_lo_tmp, 2);
-	
-	while(get_keys() != -1);
 	
-	key = get_keys();
-	while((key != 6) && (key != 7))
+	if(sel >= 0)
 	{
-	    if(tuning)
+		task[sel].next += task[sel].period;
+		if((long) (now - task[sel].next) >= 0) //Missed periods: no catch up burst
 		{
-			f_lo_tmp += pulses * pulses *  tuning;
-			si5351_set_freq(SYNTH_MS_0, f_lo_tmp);
-			show_frequency1(0, 2);
-			show_frequency1(f_lo_tmp, 2);
-			tuning = 0;
-		}
-		key = get_keys();
-	}	
-	switch(key)
-	{
-		case 6: si5351_set_freq(SYNTH_MS_0, f_lo[sb]); //Abort operation
-		        show_msg((char*)"Aborted.", LIGHTRED);
-		        runsecs_msg = runsecs;
-		        break;
-		case 7: f_lo[sb] = f_lo_tmp;		
-		        eeprom_store_frequency(8, sb, f_lo[sb]); //Set new frequency for LO
-		        show_msg((char*)"Stored.", LIGHTGREEN);
-		        runsecs_msg = runsecs;
-		        break;
+			task[sel].next = now + task[sel].period;
+		}	
+		task[sel].fn();
+		return;
 	}
-	return key;
-}
-
-///////////////////////
-//   BAND RELAY SET  //     
-///////////////////////
-void set_band_relay(int b)
-{
-	int t1;
 	
-	for(t1 = 0; t1 < 3; t1++)
+	for(t1 = 0; t1 < TASKS; t1++)
 	{
-		if((1 << t1) & b)
+		if(!task[t1].period)
 		{
-			GPIOA->ODR |= (1 << (10 + t1));
-		}
-		else	
-		{
-			GPIOA->ODR  &= ~(1 << (10 + t1));
+			task[t1].fn();
 		}
 	}
-    
-    //Set LO to preferred sideband of new ham band
-    si5351_set_freq(SYNTH_MS_0, f_lo[pref_sideband[b]]);
-    show_sideband(pref_sideband[b], 0);
+	
+	sched_idle(now);
 }	
 
+//Sleep until next interrupt (SysTick at the latest) if tick now is
+//not over. PRIMASK closes the gap between check and WFI; the waking
+//interrupt runs after __enable_irq(), so only sleep is counted as idle.
+void sched_idle(unsigned long now)
+{
+	__disable_irq();
+	if(ms_ticks == now)
+	{
+#ifdef PROFILE
+		unsigned long c0 = DWT->CYCCNT;
+		__WFI();
+		prof_idle += DWT->CYCCNT - c0;
+#else
+		__WFI();
+#endif
+	}
+	__enable_irq();
+	
+#ifdef PROFILE
+	if(DWT->CYCCNT - prof_win_c0 >= clk_hclk) //1s window
+	{
+		prof_idle_pct = prof_idle / ((DWT->CYCCNT - prof_win_c0) / 100);
+		prof_idle = 0;
+		prof_win_c0 = DWT->CYCCNT;
+	}	
+#endif
+}
+
+//Clocks in sleep mode: only peripherals that are in use (DMA, SPI,
+//I2C, ADC, timers keep running in WFI), flash and SRAM1
+void sleep_gating(void)
+{
+	RCC->AHB1LPENR = RCC->AHB1ENR | (1 << 15) | (1 << 16); //FLITFLPEN, SRAM1LPEN
+	RCC->AHB2LPENR = RCC->AHB2ENR;                         //USB OTG off
+	RCC->APB1LPENR = RCC->APB1ENR;
+	RCC->APB2LPENR = RCC->APB2ENR;
+}	
 
 int main(void)
 {
 	
-	int key;
 	int t1;
-	long runsecs_meas = 0;
-	int tx_stat_old = 0;
+	unsigned long d;
 		
     //GPIOA  power up for DDS (PA15:PA12) and LCD (PA4:PA0)
     RCC->AHB1ENR |= (1 << 0);
@@ -1745,9 +4194,9 @@ int main(void)
     //GPIOB power up for rotary encoder (PB1:PB0)
     RCC->AHB1ENR |= (1 << 1);                           
     
-    //Read TX/RX status on PB3
-    GPIOB->MODER  &= ~(3 << (3 << 1));
-    GPIOB->PUPDR  &= ~(3 << (3 << 1));
+    //Read TX/RX status on PB3 (PA0 with LCD_HW_SPI)
+    TXRX_GPIO->MODER  &= ~(3 << (TXRX_PIN << 1));
+    TXRX_GPIO->PUPDR  &= ~(3 << (TXRX_PIN << 1));
         
     //GPIOC power up for onboard LED (PC13)
     RCC->AHB1ENR |= (1 << 2);  
@@ -1777,46 +4226,34 @@ int main(void)
     GPIOA->AFR[1] = 0;                  //0b0000   
     */
             
-    /////////////////////////////////////////////////
-    // Set SystemClock to 167 MHz with 25 MHz HSE  //
-    /////////////////////////////////////////////////
-    FLASH->ACR |= 0b010;                         //2 wait state for 100 MHz
-    RCC->CR |= (1 << 16);                        //Activate external clock (HSE: 8 MHz)
-    while ((RCC->CR & (1 << 17)) == 0);          //Wait until HSE is ready
-    
-    //Configuration of PLL
-    RCC->PLLCFGR |= (1 << 22);                  //PLL source is HSE
-    
-                                                //Set PLLM
-    RCC->PLLCFGR &= ~0x3F;                      //1st Reset bits
-    RCC->PLLCFGR |= 15;                         //2nd define VCO input frequency = PLL input clock frequency (f.HSE) / PLLM with 2 ≤ PLLM ≤ 63 
-                                                //-> f.VCO.in = 25MHz / 20 = 1.25MHz
-                                                                                                
-                                                //Set PLLN: PPLLN defines VCO out frequency
-    RCC->PLLCFGR &= ~0x7FC0;                    //1st Reset bits 14:6
-    RCC->PLLCFGR |= (200 << 6);                 //2nd define f.VCO.out = f.VCO.in * 210 = 350MHz
-     
-                                                //Set PLLP: Main PLL (PLL) division factor for main system clock; Reset Bits 17:16
-    RCC->PLLCFGR &= ~(0b11 << 16);              //Reset bits 17:16
-    RCC->PLLCFGR |= (0x00 << 16);               //f.PLL.output.clock = f.VCO.out / 2 = 175MHz
-                                                
-                                                //Set PLLQ. PLLQ = division factor for USB OTG FS, SDIO and random number generator clocks
-    RCC->PLLCFGR &= ~(0b1111 << 24);            //Reset bits 27:24
-    RCC->PLLCFGR |= (8 << 24);                  //PLL-Q: f.VCO.out / 8 = 43.75MHz
-        
-    RCC->CR |= (1 << 24);                       //Activate PLL, Bit 24
-    while ((RCC->CR & (1 << 25)) == 0);         //Wait until PLL is ready Bit 25
-    
-                                                //Division of clock signal for bus system
-    RCC->CFGR |= (0b1001 << 4)                  //AHB divider:  175MHz / 4 = 43.75MHz
-              | (0b100 << 10)                   //APB1 divider: /2
-              | (0b100 << 13);                  //APB2 divider: /2
-               
-    RCC->CFGR |= 0b10;                          //Switching to PLL clock source
+    /////////////////////////
+    //Clock tree           //
+    /////////////////////////
+    clk_apply(CLK_BOOT);
     
     /////////////////////////
     //Rotary Encoder Setup //
     /////////////////////////
+#ifdef ENC_HW_TIMER
+    //PA8, PA9 as AF1 (TIM1 CH1, CH2) with pullups
+    GPIOA->MODER &= ~((3 << (8 << 1))|(3 << (9 << 1)));
+    GPIOA->MODER |= (2 << (8 << 1))|(2 << (9 << 1));
+    GPIOA->PUPDR |= (1 << (8 << 1))|(1 << (9 << 1));
+    GPIOA->AFR[1] &= ~(0xFF << 0);
+    GPIOA->AFR[1] |= (1 << 0)|(1 << 4);
+    
+    RCC->APB2ENR |= (1 << 0);           //TIM1 clock enable
+    TIM1->CCMR1 = (1 << 0) | (1 << 8)   //CC1S, CC2S: IC1 on TI1, IC2 on TI2
+                | (6 << 4) | (6 << 12); //IC1F, IC2F: input filter against contact bounce
+    TIM1->CCER = 0;                     //Both non inverted
+    TIM1->SMCR = 3;                     //SMS: encoder mode 3, count on both edges of TI1 and TI2
+    TIM1->ARR = 0xFFFF;
+    TIM1->CNT = 0;
+    TIM1->CR1 |= 1;                     //CEN
+    
+    //Initialize interrupt controller
+    NVIC_SetPriorityGrouping(3);
+#else    
     //Set PB0, PB1 as input pins
     RCC->AHB1ENR |= (1 << 1);                           //GPIOB power up
     GPIOB->MODER &= ~((3 << (0 << 1))|(3 << (1 << 1))); //PB0 und PB1 for Input
@@ -1833,70 +4270,60 @@ int main(void)
 
     NVIC_SetPriority(EXTI0_IRQn, 1); //Set Priority for each interrupt request Priority level 1
     NVIC_EnableIRQ(EXTI0_IRQn);      //Enable EXT0 IRQ from NVIC
+#endif
     
     /////////////////////////
-    //TIMER2 Setup         //
+    //Time base            //
     /////////////////////////
-    //Enable TIM2 clock (bit0)
-    RCC->APB1ENR |= (1 << 0);
-    
-    //Timer calculation
-    //Timer update frequency = TIM_CLK/(TIM_PSC+1)/(TIM_ARR + 1) 
-    TIM2->PSC = 10000-1;   //Divide system clock (f=100MHz) by 10000 -> update frequency = 10000/s
-    TIM2->ARR = 3500;      //Define overrun
-
-    //Update Interrupt Enable
-    TIM2->DIER |= (1 << 0);
-
-    TIM2->CR1 |= (1 << 0);           //Enable Timer 2 module (CEN, bit0)
-    
-    NVIC_SetPriority(TIM2_IRQn, 2); //Priority level 2
-    NVIC_EnableIRQ(TIM2_IRQn);      //Enable TIM2 IRQ from NVIC
+    time_init(); //SysTick 1ms, also runs key and encoder scan every 10ms
     
     /////////////////////////
     //ADC1 Init            //
     /////////////////////////
-    //Port config
-    for(t1 = 4; t1 < 8; t1++) //PA7:PA4 to analog mode
-    {
-        GPIOA->MODER |= (3 << (t1 << 1));           //Set PAt1 to analog mode
-    }
-        
-    //ADC config sequence
-    RCC->APB2ENR |= (1 << 8);	                    //Enable ADC1 clock (Bit8) 
-    ADC1->CR1 &= ~(1 << 8);			                //SCAN mode disabled (Bit8)
-	ADC1->CR1 &= ~(3 << 24);				        //12bit resolution (Bit24,25 0b00)
-	ADC1->SQR1 &= ~(0x0F << 20);                    //Set number of conversions projected (L[3:0] 0b0000)
-	ADC1->SQR3 &= ~(0x3FFFFFFF);	                //Clears whole 1st 30bits in register
-	ADC1->SQR3 |= (4 << 0);			                //First conversion in regular sequence: PB4 as ADC1_4 (-> select ADC channel 4 as first (and only) conversion)
-    ADC1->CR2 &= ~(1 << 1);			                //Single conversion ADON=1
-	ADC1->CR2 &= ~(1 << 11);			            //Right alignment of data bits  bit12....bit0
-	ADC1->SMPR2 |= (7 << 0);	 		            //Sampling rate 480 cycles. 16MHz bus clock for ADC. 1/16MHz = 62.5ns. 480*62.5ns=30us
-    ADC1->CR2 |= (1 << 0);                          //Switch on ADC1
-    //ADC ready for use
+    adc_init();
+    //ADC running, get_adc() reads latest samples
+    
+    /////////////////////////
+    //CAT USART1           //
+    /////////////////////////
+    cat_init();
     
     /////////////////////////
     //LCD Setup            //
     /////////////////////////
+#ifdef LCD_HW_SPI
+    //DC and RST in general purpose output mode
+    LCD_GPIO->MODER |= (1 << (DC_AO << 1));	
+    LCD_GPIO->MODER |= (1 << (RST << 1));	
+    
+    //PB3, PB5 as AF5 (SPI1 SCK, MOSI)
+    LCD_SPI_GPIO->MODER &= ~((3 << (LCD_SPI_SCK << 1)) | (3 << (LCD_SPI_MOSI << 1)));
+    LCD_SPI_GPIO->MODER |= (2 << (LCD_SPI_SCK << 1)) | (2 << (LCD_SPI_MOSI << 1));
+    LCD_SPI_GPIO->OSPEEDR |= (3 << (LCD_SPI_SCK << 1)) | (3 << (LCD_SPI_MOSI << 1));
+    LCD_SPI_GPIO->AFR[0] &= ~((0x0F << (LCD_SPI_SCK << 2)) | (0x0F << (LCD_SPI_MOSI << 2)));
+    LCD_SPI_GPIO->AFR[0] |= (5 << (LCD_SPI_SCK << 2)) | (5 << (LCD_SPI_MOSI << 2));
+    
+    RCC->APB2ENR |= (1 << 12);                      //SPI1 clock enable
+    RCC->AHB1ENR |= (1 << 22);                      //DMA2 clock enable
+    SPI1->CR1 = (1 << 15)                           //BIDIMODE: 1 line
+              | (1 << 14)                           //BIDIOE: transmit only
+              | (1 << 9) | (1 << 8)                 //SSM, SSI: software slave management
+              | (clk_spi_br(clk_pclk2, LCD_SPI_MAX) << 3) //Baud rate f.PCLK2 / 2^(BR+1)
+              | (1 << 2);                           //Master
+    SPI1->CR1 |= (1 << 6);                          //SPE: SPI on
+    
+    NVIC_SetPriority(DMA2_Stream3_IRQn, 3);
+    NVIC_EnableIRQ(DMA2_Stream3_IRQn);
+#else    
     //Put pin 0..4 in general purpose output mode
     LCD_GPIO->MODER |= (1 << (DATA << 1));	
     LCD_GPIO->MODER |= (1 << (CLK << 1));	
     LCD_GPIO->MODER |= (1 << (DC_AO << 1));	
     LCD_GPIO->MODER |= (1 << (RST << 1));	
+#endif
             
-    //Start ST7735 LCD
+    //Start ST7735 LCD reset, init follows after RF setup
     lcd_reset();
-    delay(100);
-    lcd_init();
-    lcd_cls0(backcolor);
-        
-    draw_hor_line(0, 129, calc_ypos(0) + FONTHEIGHT + 3, LIGHTBLUE);
-    draw_hor_line(0, 129, calc_ypos(1) + FONTHEIGHT + 3, LIGHTBLUE);
-    draw_vert_line(50, 0, calc_ypos(1) + FONTHEIGHT + 3, LIGHTBLUE);
-    draw_vert_line(90, 0, calc_ypos(1) + FONTHEIGHT + 3, LIGHTBLUE);
-    draw_hor_line(0, 129, calc_ypos(4) + FONTHEIGHT - 2, LIGHTBLUE);
-    draw_hor_line(0, 129, calc_ypos(5) + FONTHEIGHT + 3, LIGHTBLUE);
-    draw_hor_line(0, 129, calc_ypos(6) + FONTHEIGHT + 3, LIGHTBLUE);
     
     //Turn on the GPIOB peripheral for DDS SPI interface
     RCC->AHB1ENR |= (1 << 1);
@@ -1904,184 +4331,118 @@ int main(void)
     /////////////////////////
     //DDS Setup            //
     /////////////////////////
+#ifdef DDS_HW_SPI
+    //IO_UD and RESET in general purpose output mode
+    DDS_GPIO->MODER  |=  (1 << (DDS_IO_UD << 1));	
+    DDS_GPIO->MODER  |=  (1 << (DDS_RESET << 1));	
+    
+    //PB13, PB15 as AF5 (SPI2 SCK, MOSI)
+    DDS_GPIO->MODER &= ~((3 << (DDS_SCLK << 1)) | (3 << (DDS_SDIO << 1)));
+    DDS_GPIO->MODER |= (2 << (DDS_SCLK << 1)) | (2 << (DDS_SDIO << 1));
+    DDS_GPIO->OSPEEDR |= (3 << (DDS_SCLK << 1)) | (3 << (DDS_SDIO << 1));
+    DDS_GPIO->AFR[1] &= ~((0x0F << ((DDS_SCLK - 8) << 2)) | (0x0F << ((DDS_SDIO - 8) << 2)));
+    DDS_GPIO->AFR[1] |= (5 << ((DDS_SCLK - 8) << 2)) | (5 << ((DDS_SDIO - 8) << 2));
+    
+    RCC->APB1ENR |= (1 << 14);                      //SPI2 clock enable
+    RCC->AHB1ENR |= (1 << 21);                      //DMA1 clock enable
+    SPI2->CR1 = (1 << 15)                           //BIDIMODE: 1 line
+              | (1 << 14)                           //BIDIOE: transmit only
+              | (1 << 9) | (1 << 8)                 //SSM, SSI: software slave management
+              | (clk_spi_br(clk_pclk1, DDS_SPI_MAX) << 3) //Baud rate f.PCLK1 / 2^(BR+1)
+              | (1 << 2);                           //Master, CPOL=0, CPHA=0
+    SPI2->CR1 |= (1 << 6);                          //SPE: SPI on
+    SPI2->CR2 |= (1 << 1);                          //TXDMAEN
+    
+    NVIC_SetPriority(DMA1_Stream4_IRQn, 1);
+    NVIC_EnableIRQ(DMA1_Stream4_IRQn);
+#else    
     //Put pin AB15:B12 to general purpose output mode
     DDS_GPIO->MODER  |=  (1 << (DDS_SCLK << 1));	
     DDS_GPIO->MODER  |=  (1 << (DDS_IO_UD << 1));	
     DDS_GPIO->MODER  |=  (1 << (DDS_SDIO << 1));	
     DDS_GPIO->MODER  |=  (1 << (DDS_RESET << 1));	
-    
-    delay(100);
+#endif
+    dds_set_clock(DDS_CLOCK);
     
 	//Reset DDS (AD9951)
 	DDS_GPIO->ODR |= (1 << DDS_RESET);  
-	delay(100);
+	delay_us(DDS_RST_PULSE);
 	DDS_GPIO->ODR &= ~(1 << DDS_RESET);  
-    delay(100);
+	delay_us(DDS_RST_PULSE);
 	DDS_GPIO->ODR |= (1 << DDS_RESET);  
 	
 	/////////////////
 	// Setup I2C   //
 	/////////////////
-	RCC->APB1ENR |= RCC_APB1ENR_I2C1EN; //Enable I2C clock
-    RCC->AHB1ENR |= (1 << 1);          //GPIOB power up
-    GPIOB->MODER &= ~(3 << (6 << 1)); //PB6 as SCK
-    GPIOB->MODER |=  (2 << (6 << 1)); //Alternate function
-    GPIOB->OTYPER |= (1 << 6);        //open-drain
-    GPIOB->MODER &= ~(3 << (9 << 1)); //PB9 as SDA
-    GPIOB->MODER |=  (2 << (9 << 1)); //Alternate function
-    GPIOB->OTYPER |= (1 << 9);        //open-drain
-
-    //Choose AF4 option for I2C1 in Alternate Function registers
-    GPIOB->AFR[0] |= (4 << (6 << 2));     // for PB6
-    GPIOB->AFR[1] |= (4 << ((9 - 8) << 2)); // for PB9
-
-    //Reset and clear control register
-    I2C1->CR1 = I2C_CR1_SWRST;
-    I2C1->CR1 = 0;
-
-    //Enable error interrupt
-    I2C1->CR2 |= (I2C_CR2_ITERREN); 
-
-    //Set I2C clock
-    I2C1->CR2 |= (10 << 0); //10Mhz peripheral clock
-    I2C1->CCR |= (50 << 0);
-    //Maximum rise time set
-    I2C1->TRISE |= (11 << 0); //TRISE=11ns for 100khz
-    
-    //Enable I2C
-    I2C1->CR1 |= I2C_CR1_PE; 
+	i2c_init();
     
     //Init Si5351
     si5351_start();
     
     /////////// ALL MODULES SETUP FINISHED   ////////
     
-	//Load values
-    cur_band = eeprom_read(256);    	
+	//Load values: newest record of persistence log or legacy layout
+	t1 = boot_load();
+    
     if((cur_band < 0) || (cur_band > 7))
     {
 		cur_band = 2;
 	}	
 	
-    cur_vfo = eeprom_read(257);    	
     if((cur_vfo < 0) || (cur_vfo > 1))
     {
 		cur_vfo = 0;
 	}	
 	    
-    load_all_vfos();
-    
-	sideband = pref_sideband[cur_band];
-	
+	if(!t1 || sideband < 0 || sideband > 1)
+	{    
+	    sideband = pref_sideband[cur_band];
+	}
+	    
 	for(t1 = 0; t1 < 2; t1++)
 	{
-		f_lo[t1] = eeprom_load_frequency(8, t1);
 		if((f_lo[t1] < INTERFREQUENCY - 3000) || (f_lo[t1] > INTERFREQUENCY + 3000))
 		{
 			f_lo[t1] = INTERFREQUENCY + 1500 * (t1 * 2 - 1);
 		}	
-		si5351_set_freq(SYNTH_MS_0, f_lo[t1]);
 	}	
+	band_prepare();
 			
-	//Display data on screen 
+	//RF path: relays, LO (one register load), DDS
 	set_band_relay(cur_band);
-	show_band(cur_band, 0);
-	show_vfo(cur_vfo, cur_band, 0);
-    show_frequency1(f_vfo[cur_band][cur_vfo], 2);
-    show_sideband(1, 0);
-    show_voltage(get_vdd());
-    show_pa_temp(get_pa_temp());
-    draw_meter_scale(0);
-    show_msg((char*)"DK7IH 8-Band-TRX", LIGHTBLUE);    
+	if(sideband != pref_sideband[cur_band]) //Restored sideband differs from preset
+	{
+		si5351_load(SYNTH_MS_0, si5351_lo[sideband], si5351_ms_lo);
+	}	
+	set_frequency(f_vfo[cur_band][cur_vfo]);
+	
+	//Status read is queued behind all register writes: returns when
+	//the LO is written and PLLA has locked (SYS_INIT, LOL_A clear)
+	d = deadline(BOOT_LOCK_WAIT);
+	while((i2c_read(0, SI5351_ADR) & 0xA0) && !expired(d));
+	boot_rx_ms = millis();
+	mem_load();
+	
+	//Display: reset has passed meanwhile, screen is composed and the
+	//values are drawn by the render task
+    lcd_init();
+#ifdef LCD_FRAMEBUFFER
+    lcd_fb_begin();
+#endif
+	redraw_screen();
+#ifdef PROFILE
+	rq_post(RQ_MSG, boot_rx_ms, (boot_rx_ms > BOOT_RX_TARGET) ? LIGHTRED : LIGHTGREEN, 0, "Boot RX ms:");
+	msg_deadline = deadline(MSG_TIME);
+#endif
+    
+    lcd_idle_hook = tune_vfo; //Retune DDS also while LCD transfers are running
+    sleep_gating();           //All peripherals are on now
         
+    sched_init();
+    
     for(;;) 
 	{
-		if(tuning)
-		{
-			f_vfo[cur_band][cur_vfo] += pulses * pulses *  tuning;
-			set_frequency(f_vfo[cur_band][cur_vfo]);
-			show_frequency1(f_vfo[cur_band][cur_vfo], 2);
-			tuning = 0;
-		}		
-		        
-        key = get_keys();
-        
-        switch(key)
-        {
-			case 0: if(cur_band < (MAXBANDS - 1))
-			        {
-						cur_band++;
-						set_frequency(f_vfo[cur_band][cur_vfo]);
-						show_frequency1(0, 2);
-						show_frequency1(f_vfo[cur_band][cur_vfo], 2);
-						show_band(cur_band, 0);
-						set_band_relay(cur_band);
-						eeprom_write(256, cur_band);
-					}
-					break;
-					
-			case 1: sideband = !sideband;
-			        show_sideband(sideband, 0);
-			        break;
-			        
-			case 2: cur_vfo = !cur_vfo;
-			        eeprom_write(257, cur_vfo);
-			        show_vfo(cur_vfo, cur_band, 0);
-			        set_frequency(f_vfo[cur_band][cur_vfo]);
-					show_frequency1(f_vfo[cur_band][cur_vfo], 2);
-					break;        
-					
-			case 3: if(cur_band > 0)
-			        {
-						cur_band--;
-						set_frequency(f_vfo[cur_band][cur_vfo]);
-						show_frequency1(0, 2);
-						show_frequency1(f_vfo[cur_band][cur_vfo], 2);
-						show_band(cur_band, 0);
-						set_band_relay(cur_band);
-						eeprom_write(256, cur_band);
-					}		
-					break;
-					
-			case 4: save_all_vfos();
-			        show_msg((char*)"Saved.", LIGHTGREEN);
-			        runsecs_msg = runsecs;
-			        break;		
-			        
-			case 6: set_lo(0);
-			        show_frequency1(f_vfo[cur_band][cur_vfo], 2);
-			        show_sideband(sideband, 0);
-			        break;    
-			          
-			case 7: set_lo(1);
-			        show_frequency1(f_vfo[cur_band][cur_vfo], 2); 
-			        show_sideband(sideband, 0);
-			        break;        
-		}	
-		
-		show_meter(get_sval());
-		
-		//Clear message line
-		if((runsecs > runsecs_msg + 3) && runsecs_msg)
-		{
-			show_msg((char*)"DK7IH 8-Band-TRX", LIGHTBLUE);    
-			runsecs_msg = 0;		
-		}	
-
-        if(get_txrx() != tx_stat_old)
-        {
-            show_txrx();
-            tx_stat_old = get_txrx();
-        }    
-            
-					
-		//Show VDD, PATMP evry 3 secs
-		if(runsecs > runsecs_meas + 3)
-		{
-			show_pa_temp(get_pa_temp());
-		    show_voltage(get_vdd());	
-			runsecs_meas = runsecs;		
-		}	
+		sched_run();
 	}
 	return 0;
 }
@@ -0,0 +1,324 @@
+///////////////////////////////////////////////////////////////////
+//   Host benchmark and regression test of trx_core.c            //
+///////////////////////////////////////////////////////////////////
+//Runs the portable code against the mock backends, checks results
+//against reference math and the models, prints time and bus bytes
+//per call. Exit code != 0 if a check fails or an operation sends
+//more bytes than its budget (bus traffic is deterministic, time is
+//only reported).
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "trx_core.h"
+#include "hal_mock.h"
+
+#define LO_USB 9001500 //Typical LO for 10 MHz IF
+#define LO_STEPS  2000 //1 Hz steps per run
+
+int fails = 0;
+
+#define CHECK(c) check((c), #c, __LINE__)
+
+static void check(int ok, const char *what, int line)
+{
+	if(!ok)
+	{
+		printf("FAIL line %d: %s\n", line, what);
+		fails++;
+	}
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//Result row: time and bytes per call, budget for the bus bytes
+//(-1: no budget). Fails if any bus exceeds its budget per call.
+static void report(const char *name, long n, double ns, struct io_stats *s0, long budget)
+{
+	double lcd = (double) (io_stat.lcd - s0->lcd) / n;
+	double i2c = (double) (io_stat.i2c - s0->i2c) / n;
+	double dds = (double) (io_stat.dds - s0->dds) / n;
+	int over = (budget >= 0) && (lcd > budget || i2c > budget || dds > budget);
+
+	printf("%-22s %8ld %10.1f %9.1f %9.1f %9.1f %7ld %s\n", name, n, ns / n, lcd, i2c, dds, budget, over ? "OVER" : "");
+	if(over)
+	{
+		fails++;
+	}
+}
+
+  ///////////////////////
+ //   CHECKS          //
+///////////////////////
+static void check_strings(void)
+{
+	char s[16];
+
+	CHECK(int2asc(-12345, 2, s, 16) == 7 && !strcmp(s, "-123.45"));
+	CHECK(int2asc(7, 1, s, 16) == 3 && !strcmp(s, "0.7"));
+	CHECK(int2asc(0, 0, s, 16) == 1 && !strcmp(s, "0"));
+	CHECK(int2asc(2147483647L, 0, s, 16) == 10 && !strcmp(s, "2147483647"));
+	CHECK(int2asc(123456, 0, s, 4) == 3 && !strcmp(s, "123")); //Truncated, terminated
+	CHECK(freq2asc(14200000, s, 16) == 7 && !strcmp(s, "14200.0"));
+	CHECK(freq2asc(1810050, s, 16) == 6 && !strcmp(s, "1810.0"));
+}
+
+static void check_dds(void)
+{
+	unsigned long f[] = {0, 1, 1810000, 11810000, 24000000, 39700000, 150000000};
+	unsigned long clk[] = {DDS_CLOCK, DDS_CLOCK - DDS_CLOCK / 250, DDS_CLOCK + DDS_CLOCK / 100};
+	unsigned long long ref;
+	int t1, t2;
+	long d;
+
+	for(t2 = 0; t2 < 3; t2++)
+	{
+		dds_set_clock(clk[t2]);
+		for(t1 = 0; t1 < 7; t1++)
+		{
+			ref = (((unsigned long long) f[t1] << 32) + dds_clock / 2) / dds_clock;
+			d = (long) dds_ftw(f[t1]) - (long) ref;
+			CHECK(d >= -1 && d <= 1);
+		}
+	}
+	CHECK(dds_clock == DDS_CLOCK); //Last clock is > 0.5% off, rejected
+
+	set_frequency(14200000);
+	CHECK(mock_dds_writes == 1 && mock_dds_ftw == dds_ftw(14200000 + INTERFREQUENCY));
+}
+
+static void check_si5351(void)
+{
+	long f[] = {LO_USB, 8998500, 10000000, 3500000, 27000000, LO_USB + 1};
+	double e;
+	unsigned long b;
+	int t1;
+
+	si5351_start();
+	CHECK((mock_si5351[CLK0_CONTROL] & 0x40) && mock_si5351[XTAL_LOAD_CAP] == 0xD2);
+	for(t1 = 0; t1 < 6; t1++)
+	{
+		si5351_set_freq(SYNTH_MS_0, f[t1]);
+		e = mock_si5351_freq(SYNTH_MS_0) - f[t1];
+		CHECK(e > -1 && e < 1);
+		CHECK(!(si5351_msdiv & 1) && f[t1] * si5351_msdiv >= SI5351_VCO_MIN && f[t1] * si5351_msdiv <= SI5351_VCO_MAX);
+	}
+
+	//Same frequency again: nothing on the bus
+	b = mock_si5351_bursts;
+	si5351_set_freq(SYNTH_MS_0, LO_USB + 1);
+	CHECK(mock_si5351_bursts == b);
+
+	//Failed burst must not leave the shadow claiming the new value
+	mock_i2c_fail = 1;
+	si5351_set_freq(SYNTH_MS_0, LO_USB + 100);
+	mock_i2c_fail = 0;
+	si5351_set_freq(SYNTH_MS_0, LO_USB + 100);
+	e = mock_si5351_freq(SYNTH_MS_0) - (LO_USB + 100);
+	CHECK(e > -1 && e < 1);
+}
+
+//Pixel x, y of char ch at stretch sx, sy as drawn at 0, 0
+static int font_pixel(unsigned char ch, int x, int y, int sx, int sy)
+{
+	return (xchar[ch - CHAROFFSET][y / sy] >> (x / sx)) & 1;
+}
+
+static void check_lcd(void)
+{
+	const char *s = "8A.?";
+	int t1, x, y, sx, ok;
+
+	for(sx = 1; sx <= 2; sx++)
+	{
+		for(t1 = 0; s[t1]; t1++)
+		{
+			mock_reset();
+			lcd_putchar(0, 0, s[t1], WHITE, BLACK, sx, sx);
+			ok = 1;
+			for(y = 0; y < (FONTHEIGHT - 1) * sx; y++)
+			{
+				for(x = 0; x < FONTWIDTH * sx; x++)
+				{
+					ok &= mock_lcd[y + 2][x + 2] == (font_pixel(s[t1], x, y, sx, sx) ? WHITE : BLACK);
+				}
+			}
+			CHECK(ok);
+		}
+	}
+
+	mock_reset();
+	lcd_fill_rect(10, 20, 19, 24, RED);
+	CHECK(mock_lcd[20][10] == RED && mock_lcd[24][19] == RED && !mock_lcd[25][19] && !mock_lcd[20][20]);
+	CHECK(io_stat.lcd == 10 + 1 + 50 * 2);
+}
+
+static void check_meter(void)
+{
+	int t1, sv;
+
+	mock_reset();
+	mock_adc[MTR] = 80 << 4;
+	for(t1 = 0; t1 < 200; t1++)
+	{
+		mock_ms += 10;
+		sv = meter_update(get_sval(), mock_ms);
+		if(sv >= 0)
+		{
+			draw_meter(sv, smax);
+		}
+	}
+	CHECK(sv_old == 80 && smax == 80);
+	CHECK(mock_lcd[METERY][2] == GREEN && mock_lcd[METERY][2 + 79] == LIGHTYELLOW && mock_lcd[METERY][2 + 81] == 0);
+	CHECK(mock_lcd[METERY][2 + 80] == WHITE); //Peak marker right of bar
+
+	//Signal gone: bar falls at once, peak is held, then decays
+	mock_adc[MTR] = 0;
+	for(t1 = 0; t1 < 50; t1++)
+	{
+		mock_ms += 10;
+		sv = meter_update(get_sval(), mock_ms);
+		if(sv >= 0)
+		{
+			draw_meter(sv, smax);
+		}
+	}
+	CHECK(sv_old < 10 && smax == 80 && mock_lcd[METERY][2 + 79] == backcolor && mock_lcd[METERY][2 + 80] == WHITE);
+	mock_ms += METER_HOLD;
+	meter_update(get_sval(), mock_ms);
+	CHECK(smax == 80 - METER_DECAY);
+}
+
+  ///////////////////////
+ //   BENCHMARKS      //
+///////////////////////
+static void bench_int2asc(void)
+{
+	struct io_stats s0 = io_stat;
+	char s[16];
+	long t1, n = 1000000, sum = 0;
+	double t = now_ns();
+
+	for(t1 = 0; t1 < n; t1++)
+	{
+		sum += int2asc(t1 * 29 - 7000000, 1, s, 16);
+	}
+	report("int2asc", n, now_ns() - t, &s0, 0);
+	CHECK(sum > n);
+}
+
+static void bench_set_frequency(void)
+{
+	struct io_stats s0 = io_stat;
+	long t1, n = 1000000;
+	double t = now_ns();
+
+	for(t1 = 0; t1 < n; t1++)
+	{
+		set_frequency(14000000 + t1);
+	}
+	report("set_frequency", n, now_ns() - t, &s0, 5);
+}
+
+//Tuning the LO in 1 Hz steps: only the changed PLLA fraction bytes
+static void bench_si5351_step(void)
+{
+	struct io_stats s0;
+	long t1;
+	double t;
+
+	si5351_set_freq(SYNTH_MS_0, LO_USB);
+	s0 = io_stat;
+	t = now_ns();
+	for(t1 = 1; t1 <= LO_STEPS; t1++)
+	{
+		si5351_set_freq(SYNTH_MS_0, LO_USB + t1);
+	}
+	report("si5351_set_freq 1Hz", LO_STEPS, now_ns() - t, &s0, 4);
+}
+
+//Sideband change: both LO sets precomputed, load only
+static void bench_si5351_sideband(void)
+{
+	uint8_t pll[2][8], ms[8];
+	struct io_stats s0;
+	long t1, n = 2000;
+	unsigned long div = si5351_div(LO_USB);
+	double t;
+
+	si5351_calc(LO_USB, div, pll[0], ms);
+	si5351_calc(LO_USB - 3000, div, pll[1], ms);
+	si5351_load(SYNTH_MS_0, pll[0], ms);
+	s0 = io_stat;
+	t = now_ns();
+	for(t1 = 0; t1 < n; t1++)
+	{
+		si5351_load(SYNTH_MS_0, pll[(t1 & 1) ^ 1], ms);
+	}
+	report("si5351_load sideband", n, now_ns() - t, &s0, 8);
+}
+
+static void bench_putchar(int sx, const char *name, long budget)
+{
+	struct io_stats s0 = io_stat;
+	long t1, n = 100000;
+	double t = now_ns();
+
+	for(t1 = 0; t1 < n; t1++)
+	{
+		lcd_putchar((t1 % 6) * FONTWIDTH * sx, 30, '0' + t1 % 10, YELLOW, backcolor, sx, sx);
+	}
+	report(name, n, now_ns() - t, &s0, budget);
+}
+
+//S-meter on a fading signal, 10 ms task period
+static void bench_meter(void)
+{
+	struct io_stats s0 = io_stat;
+	long t1, n = 100000;
+	int sv;
+	double t = now_ns();
+
+	for(t1 = 0; t1 < n; t1++)
+	{
+		mock_ms += 10;
+		mock_adc[MTR] = ((t1 / 50) & 1) ? 400 + (t1 % 50) * 20 : 1600 - (t1 % 50) * 24;
+		sv = meter_update(get_sval(), mock_ms);
+		if(sv >= 0)
+		{
+			draw_meter(sv, smax);
+		}
+	}
+	report("show_meter", n, now_ns() - t, &s0, 30);
+}
+
+int main(void)
+{
+	mock_reset();
+	check_strings();
+	check_dds();
+	check_si5351();
+	check_lcd();
+	check_meter();
+
+	mock_reset();
+	si5351_start();
+	printf("%-22s %8s %10s %9s %9s %9s %7s\n", "operation", "calls", "ns/call", "lcd B", "i2c B", "dds B", "budget");
+	bench_int2asc();
+	bench_set_frequency();
+	bench_si5351_step();
+	bench_si5351_sideband();
+	bench_putchar(1, "lcd_putchar 1x1", 187);
+	bench_putchar(2, "lcd_putchar 2x2 cached", 715);
+	bench_meter();
+	printf("io_stat total: lcd %lu, i2c %lu, dds %lu bytes\n", io_stat.lcd, io_stat.i2c, io_stat.dds);
+	printf("%s\n", fails ? "FAILED" : "OK");
+
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,225 @@
+///////////////////////////////////////////////////////////////////
+//   Host backends of trx_hal.h, see hal_mock.h                  //
+///////////////////////////////////////////////////////////////////
+//Every transport counts its bytes into io_stat the way the target
+//drivers do with PROFILE: command and data byte 1, pixel 2, DDS
+//tuning word 5 (instruction + 4), I2C address + payload.
+
+#include <string.h>
+#include "trx_core.h"
+#include "hal_mock.h"
+
+struct io_stats io_stat;
+
+uint16_t mock_lcd[MOCK_LCD_H][MOCK_LCD_W];
+unsigned long mock_lcd_cmds;
+unsigned long mock_dds_ftw;
+unsigned long mock_dds_writes;
+uint8_t mock_si5351[256];
+unsigned long mock_si5351_bursts;
+int mock_i2c_fail;
+int mock_adc[5];
+unsigned long mock_ms;
+
+//ST7735 state machine
+static int lcd_cmd;                          //Last command
+static int lcd_arg[4], lcd_nargs;            //Parameter bytes of CASET/RASET
+static int lcd_x0, lcd_x1, lcd_y0, lcd_y1;   //Window
+static int lcd_cx, lcd_cy;                   //RAM write position
+
+void mock_reset(void)
+{
+	memset(&io_stat, 0, sizeof(io_stat));
+	memset(mock_lcd, 0, sizeof(mock_lcd));
+	memset(mock_si5351, 0, sizeof(mock_si5351));
+	memset(mock_adc, 0, sizeof(mock_adc));
+	mock_lcd_cmds = 0;
+	mock_dds_ftw = 0;
+	mock_dds_writes = 0;
+	mock_si5351_bursts = 0;
+	mock_i2c_fail = 0;
+	mock_ms = 0;
+	lcd_cmd = 0;
+	lcd_nargs = 0;
+	lcd_x0 = lcd_y0 = lcd_cx = lcd_cy = 0;
+	lcd_x1 = MOCK_LCD_W - 1;
+	lcd_y1 = MOCK_LCD_H - 1;
+}
+
+  ///////////////////////
+ //   LCD             //
+///////////////////////
+void lcd_write_command(int cmd)
+{
+	io_stat.lcd++;
+	mock_lcd_cmds++;
+	lcd_cmd = cmd;
+	lcd_nargs = 0;
+	if(cmd == ST7735_RAMWR)
+	{
+		lcd_cx = lcd_x0;
+		lcd_cy = lcd_y0;
+	}
+}
+
+void lcd_write_data(int d)
+{
+	io_stat.lcd++;
+	if((lcd_cmd != ST7735_CASET && lcd_cmd != ST7735_RASET) || lcd_nargs >= 4)
+	{
+		return;
+	}
+	lcd_arg[lcd_nargs++] = d & 0xFF;
+	if(lcd_nargs < 4)
+	{
+		return;
+	}
+	if(lcd_cmd == ST7735_CASET)
+	{
+		lcd_x0 = (lcd_arg[0] << 8) | lcd_arg[1];
+		lcd_x1 = (lcd_arg[2] << 8) | lcd_arg[3];
+	}
+	else
+	{
+		lcd_y0 = (lcd_arg[0] << 8) | lcd_arg[1];
+		lcd_y1 = (lcd_arg[2] << 8) | lcd_arg[3];
+	}
+}
+
+//One pixel at write position, wraps in window like the controller
+static void lcd_put(uint16_t c)
+{
+	if(lcd_cx < MOCK_LCD_W && lcd_cy < MOCK_LCD_H)
+	{
+		mock_lcd[lcd_cy][lcd_cx] = c;
+	}
+	if(++lcd_cx > lcd_x1)
+	{
+		lcd_cx = lcd_x0;
+		if(++lcd_cy > lcd_y1)
+		{
+			lcd_cy = lcd_y0;
+		}
+	}
+}
+
+void lcd_write_pixels(const uint16_t *buf, int n)
+{
+	int t1;
+
+	if(n <= 0)
+	{
+		return;
+	}
+	io_stat.lcd += n * 2;
+	for(t1 = 0; t1 < n; t1++)
+	{
+		lcd_put(buf[t1]);
+	}
+}
+
+void lcd_fill_pixels(unsigned int color, int n)
+{
+	int t1;
+
+	if(n <= 0)
+	{
+		return;
+	}
+	io_stat.lcd += n * 2;
+	for(t1 = 0; t1 < n; t1++)
+	{
+		lcd_put(color);
+	}
+}
+
+//Transfers complete immediately
+void lcd_wait(void)
+{
+}
+
+//Same byte sequence as the target driver
+void lcd_setwindow(int x0, int y0, int x1, int y1)
+{
+	lcd_write_command(ST7735_CASET);
+	lcd_write_data(0x00);
+	lcd_write_data(x0);
+	lcd_write_data(0x00);
+	lcd_write_data(x1);
+
+	lcd_write_command(ST7735_RASET);
+	lcd_write_data(0x00);
+	lcd_write_data(y0);
+	lcd_write_data(0x00);
+	lcd_write_data(y1);
+}
+
+  ///////////////////////
+ //   DDS             //
+///////////////////////
+void dds_write_ftw(unsigned long ftw)
+{
+	io_stat.dds += 5;
+	mock_dds_ftw = ftw & 0xFFFFFFFFUL;
+	mock_dds_writes++;
+}
+
+  ///////////////////////
+ //   Si5351          //
+///////////////////////
+void si5351_bus_write(uint8_t *buf, int n)
+{
+	int t1;
+
+	io_stat.i2c += 1 + n;
+	mock_si5351_bursts++;
+	if(mock_i2c_fail)
+	{
+		si5351_invalidate(buf[0], n - 1);
+		return;
+	}
+	for(t1 = 1; t1 < n; t1++)
+	{
+		mock_si5351[(buf[0] + t1 - 1) & 0xFF] = buf[t1];
+	}
+}
+
+//a + b/c of the 8 parameter registers at reg (AN619 p.3)
+static double si5351_ratio(int reg)
+{
+	uint8_t *r = &mock_si5351[reg];
+	unsigned long p1 = ((unsigned long) (r[2] & 0x03) << 16) | (r[3] << 8) | r[4];
+	unsigned long p2 = ((unsigned long) (r[5] & 0x0F) << 16) | (r[6] << 8) | r[7];
+	unsigned long p3 = ((unsigned long) (r[5] & 0xF0) << 12) | (r[0] << 8) | r[1];
+
+	if(!p3)
+	{
+		return 0;
+	}
+	return (p1 + 512 + (double) p2 / p3) / 128;
+}
+
+//Output of multisynth synth fed by PLLA
+double mock_si5351_freq(int synth)
+{
+	double ms = si5351_ratio(synth);
+
+	if(ms == 0)
+	{
+		return 0;
+	}
+	return FXTAL * si5351_ratio(SYNTH_PLL_A) / ms;
+}
+
+  ///////////////////////
+ //   ADC, time       //
+///////////////////////
+int get_adc(int ch)
+{
+	return mock_adc[ch];
+}
+
+unsigned long millis(void)
+{
+	return mock_ms;
+}
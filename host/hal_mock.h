@@ -0,0 +1,36 @@
+///////////////////////////////////////////////////////////////////
+//   Host backends of trx_hal.h: models of ST7735, AD9951,       //
+//   Si5351 and ADC that record what the core sends              //
+///////////////////////////////////////////////////////////////////
+
+#ifndef HAL_MOCK_H
+#define HAL_MOCK_H
+
+#include "trx_hal.h"
+
+#define MOCK_LCD_W 132  //ST7735 controller RAM
+#define MOCK_LCD_H 132
+
+//LCD: RAM written through CASET/RASET/RAMWR
+extern uint16_t mock_lcd[MOCK_LCD_H][MOCK_LCD_W];
+extern unsigned long mock_lcd_cmds;   //Commands received
+
+//DDS: last tuning word and number of writes
+extern unsigned long mock_dds_ftw;
+extern unsigned long mock_dds_writes;
+
+//Si5351: register file (auto-increment bursts), bursts received.
+//With mock_i2c_fail set the next bursts are dropped and reported
+//to si5351_invalidate() like a NACK on the target.
+extern uint8_t mock_si5351[256];
+extern unsigned long mock_si5351_bursts;
+extern int mock_i2c_fail;
+
+//ADC channels KEYS..TMP and ms clock
+extern int mock_adc[5];
+extern unsigned long mock_ms;
+
+void mock_reset(void);                           //Clear models and io_stat
+double mock_si5351_freq(int);                    //CLK output from PLLA and multisynth registers
+
+#endif
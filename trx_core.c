@@ -0,0 +1,708 @@
+///////////////////////////////////////////////////////////////////
+//   Portable radio code of the 8-Band-TRX, see trx_core.h       //
+///////////////////////////////////////////////////////////////////
+
+#include "trx_core.h"
+
+//Variables
+//LCD
+unsigned int backcolor = DARKBLUE2;
+uint16_t lcd_pixbuf[LCD_PIXBUF_SIZE];
+
+//Glyph cache for stretched chars (frequency display)
+#define GLYPH_CACHE_BYTES 11264 //RAM budget for expanded pixels
+#define GLYPH_CACHE_SLOTS (GLYPH_CACHE_BYTES / (LCD_PIXBUF_SIZE * 2))
+struct glyph_slot
+{
+	unsigned char ch, sx, sy;
+	uint16_t fcol, bcol;
+	unsigned long used;          //LRU stamp, 0 = slot empty
+	uint16_t pix[LCD_PIXBUF_SIZE];
+};
+struct glyph_slot glyph_cache[GLYPH_CACHE_SLOTS];
+unsigned long glyph_stamp = 0;
+
+//Si5351 register shadow: last value written to chip
+uint8_t si5351_shadow[SI5351_REGS];
+volatile uint8_t si5351_known[SI5351_REGS]; //1: shadow is valid (cleared by failed burst)
+unsigned long si5351_msdiv = 0; //Even integer divider of CLK0 multisynth, 0 = not chosen
+
+//DDS
+unsigned long dds_clock = DDS_CLOCK;
+unsigned long long dds_ftw_scale;  //2^64 / dds_clock, FTW = (f * scale) >> 32
+
+//S-Meter
+int smax = 0;        //Peak value
+int smax_shown = -1; //Column of peak marker on screen
+int sv_old = 0;      //Columns of bar on screen
+int sv_filt = 0;     //Smoothed value * 16
+unsigned long smax_t = 0; //ms at last peak
+
+//Font
+const unsigned char xchar[][FONTHEIGHT] ={
+{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x20
+{0x00,0x0C,0x1E,0x1E,0x1E,0x0C,0x0C,0x00,0x0C,0x0C,0x00,0x00},	// 0x21
+{0x00,0x66,0x66,0x66,0x24,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x22
+{0x00,0x36,0x36,0x7F,0x36,0x36,0x36,0x7F,0x36,0x36,0x00,0x00},	// 0x23
+{0x0C,0x0C,0x3E,0x03,0x03,0x1E,0x30,0x30,0x1F,0x0C,0x0C,0x00},	// 0x24
+{0x00,0x00,0x00,0x23,0x33,0x18,0x0C,0x06,0x33,0x31,0x00,0x00},	// 0x25
+{0x00,0x0E,0x1B,0x1B,0x0E,0x5F,0x7B,0x33,0x3B,0x6E,0x00,0x00},	// 0x26
+{0x00,0x0C,0x0C,0x0C,0x06,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x27
+{0x00,0x30,0x18,0x0C,0x06,0x06,0x06,0x0C,0x18,0x30,0x00,0x00},	// 0x28
+{0x00,0x06,0x0C,0x18,0x30,0x30,0x30,0x18,0x0C,0x06,0x00,0x00},	// 0x29
+{0x00,0x00,0x00,0x66,0x3C,0xFF,0x3C,0x66,0x00,0x00,0x00,0x00},	// 0x2A
+{0x00,0x00,0x00,0x18,0x18,0x7E,0x18,0x18,0x00,0x00,0x00,0x00},	// 0x2B
+{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x1C,0x1C,0x06,0x00},	// 0x2C
+{0x00,0x00,0x00,0x00,0x00,0x7F,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x2D
+{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x1C,0x1C,0x00,0x00},	// 0x2E
+{0x00,0x00,0x40,0x60,0x30,0x18,0x0C,0x06,0x03,0x01,0x00,0x00},	// 0x2F
+{0x00,0x3E,0x63,0x63,0x63,0x6B,0x63,0x63,0x63,0x3E,0x00,0x00},	// 0x30
+{0x00,0x08,0x0C,0x0F,0x0C,0x0C,0x0C,0x0C,0x0C,0x3F,0x00,0x00},	// 0x31
+{0x00,0x1E,0x33,0x33,0x30,0x18,0x0C,0x06,0x33,0x3F,0x00,0x00},	// 0x32
+{0x00,0x1E,0x33,0x30,0x30,0x1C,0x30,0x30,0x33,0x1E,0x00,0x00},	// 0x33
+{0x00,0x30,0x38,0x3C,0x36,0x33,0x7F,0x30,0x30,0x78,0x00,0x00},	// 0x34
+{0x00,0x3F,0x03,0x03,0x03,0x1F,0x30,0x30,0x33,0x1E,0x00,0x00},	// 0x35
+{0x00,0x1C,0x06,0x03,0x03,0x1F,0x33,0x33,0x33,0x1E,0x00,0x00},	// 0x36
+{0x00,0x7F,0x63,0x63,0x60,0x30,0x18,0x0C,0x0C,0x0C,0x00,0x00},	// 0x37
+{0x00,0x1E,0x33,0x33,0x33,0x1E,0x33,0x33,0x33,0x1E,0x00,0x00},	// 0x38
+{0x00,0x1E,0x33,0x33,0x33,0x3E,0x18,0x18,0x0C,0x0E,0x00,0x00},	// 0x39
+{0x00,0x00,0x00,0x1C,0x1C,0x00,0x00,0x1C,0x1C,0x00,0x00,0x00},	// 0x3A
+{0x00,0x00,0x00,0x1C,0x1C,0x00,0x00,0x1C,0x1C,0x18,0x0C,0x00},	// 0x3B
+{0x00,0x30,0x18,0x0C,0x06,0x03,0x06,0x0C,0x18,0x30,0x00,0x00},	// 0x3C
+{0x00,0x00,0x00,0x00,0x7E,0x00,0x7E,0x00,0x00,0x00,0x00,0x00},	// 0x3D
+{0x00,0x06,0x0C,0x18,0x30,0x60,0x30,0x18,0x0C,0x06,0x00,0x00},	// 0x3E
+{0x00,0x1E,0x33,0x30,0x18,0x0C,0x0C,0x00,0x0C,0x0C,0x00,0x00},	// 0x3F
+{0x00,0x3E,0x63,0x63,0x7B,0x7B,0x7B,0x03,0x03,0x3E,0x00,0x00},	// 0x40
+{0x00,0x0C,0x1E,0x33,0x33,0x33,0x3F,0x33,0x33,0x33,0x00,0x00},	// 0x41
+{0x00,0x3F,0x66,0x66,0x66,0x3E,0x66,0x66,0x66,0x3F,0x00,0x00},	// 0x42
+{0x00,0x3C,0x66,0x63,0x03,0x03,0x03,0x63,0x66,0x3C,0x00,0x00},	// 0x43
+{0x00,0x1F,0x36,0x66,0x66,0x66,0x66,0x66,0x36,0x1F,0x00,0x00},	// 0x44
+{0x00,0x7F,0x46,0x06,0x26,0x3E,0x26,0x06,0x46,0x7F,0x00,0x00},	// 0x45
+{0x00,0x7F,0x66,0x46,0x26,0x3E,0x26,0x06,0x06,0x0F,0x00,0x00},	// 0x46
+{0x00,0x3C,0x66,0x63,0x03,0x03,0x73,0x63,0x66,0x7C,0x00,0x00},	// 0x47
+{0x00,0x33,0x33,0x33,0x33,0x3F,0x33,0x33,0x33,0x33,0x00,0x00},	// 0x48
+{0x00,0x1E,0x0C,0x0C,0x0C,0x0C,0x0C,0x0C,0x0C,0x1E,0x00,0x00},	// 0x49
+{0x00,0x78,0x30,0x30,0x30,0x30,0x33,0x33,0x33,0x1E,0x00,0x00},	// 0x4A
+{0x00,0x67,0x66,0x36,0x36,0x1E,0x36,0x36,0x66,0x67,0x00,0x00},	// 0x4B
+{0x00,0x0F,0x06,0x06,0x06,0x06,0x46,0x66,0x66,0x7F,0x00,0x00},	// 0x4C
+{0x00,0x63,0x77,0x7F,0x7F,0x6B,0x63,0x63,0x63,0x63,0x00,0x00},	// 0x4D
+{0x00,0x63,0x63,0x67,0x6F,0x7F,0x7B,0x73,0x63,0x63,0x00,0x00},	// 0x4E
+{0x00,0x1C,0x36,0x63,0x63,0x63,0x63,0x63,0x36,0x1C,0x00,0x00},	// 0x4F
+{0x00,0x3F,0x66,0x66,0x66,0x3E,0x06,0x06,0x06,0x0F,0x00,0x00},	// 0x50
+{0x00,0x1C,0x36,0x63,0x63,0x63,0x73,0x7B,0x3E,0x30,0x78,0x00},	// 0x51
+{0x00,0x3F,0x66,0x66,0x66,0x3E,0x36,0x66,0x66,0x67,0x00,0x00},	// 0x52
+{0x00,0x1E,0x33,0x33,0x03,0x0E,0x18,0x33,0x33,0x1E,0x00,0x00},	// 0x53
+{0x00,0x3F,0x2D,0x0C,0x0C,0x0C,0x0C,0x0C,0x0C,0x1E,0x00,0x00},	// 0x54
+{0x00,0x33,0x33,0x33,0x33,0x33,0x33,0x33,0x33,0x1E,0x00,0x00},	// 0x55
+{0x00,0x33,0x33,0x33,0x33,0x33,0x33,0x33,0x1E,0x0C,0x00,0x00},	// 0x56
+{0x00,0x63,0x63,0x63,0x63,0x6B,0x6B,0x36,0x36,0x36,0x00,0x00},	// 0x57
+{0x00,0x33,0x33,0x33,0x1E,0x0C,0x1E,0x33,0x33,0x33,0x00,0x00},	// 0x58
+{0x00,0x33,0x33,0x33,0x33,0x1E,0x0C,0x0C,0x0C,0x1E,0x00,0x00},	// 0x59
+{0x00,0x7F,0x73,0x19,0x18,0x0C,0x06,0x46,0x63,0x7F,0x00,0x00},	// 0x5A
+{0x00,0x3C,0x0C,0x0C,0x0C,0x0C,0x0C,0x0C,0x0C,0x3C,0x00,0x00},	// 0x5B
+{0x00,0x00,0x01,0x03,0x06,0x0C,0x18,0x30,0x60,0x40,0x00,0x00},	// 0x5C
+{0x00,0x3C,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x3C,0x00,0x00},	// 0x5D
+{0x08,0x1C,0x36,0x63,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x5E
+{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xFF,0x00},	// 0x5F
+{0x0C,0x0C,0x18,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x60
+{0x00,0x00,0x00,0x00,0x1E,0x30,0x3E,0x33,0x33,0x6E,0x00,0x00},	// 0x61
+{0x00,0x07,0x06,0x06,0x3E,0x66,0x66,0x66,0x66,0x3B,0x00,0x00},	// 0x62
+{0x00,0x00,0x00,0x00,0x1E,0x33,0x03,0x03,0x33,0x1E,0x00,0x00},	// 0x63
+{0x00,0x38,0x30,0x30,0x3E,0x33,0x33,0x33,0x33,0x6E,0x00,0x00},	// 0x64
+{0x00,0x00,0x00,0x00,0x1E,0x33,0x3F,0x03,0x33,0x1E,0x00,0x00},	// 0x65
+{0x00,0x1C,0x36,0x06,0x06,0x1F,0x06,0x06,0x06,0x0F,0x00,0x00},	// 0x66
+{0x00,0x00,0x00,0x00,0x6E,0x33,0x33,0x33,0x3E,0x30,0x33,0x1E},	// 0x67
+{0x00,0x07,0x06,0x06,0x36,0x6E,0x66,0x66,0x66,0x67,0x00,0x00},	// 0x68
+{0x00,0x18,0x18,0x00,0x1E,0x18,0x18,0x18,0x18,0x7E,0x00,0x00},	// 0x69
+{0x00,0x30,0x30,0x00,0x3C,0x30,0x30,0x30,0x30,0x33,0x33,0x1E},	// 0x6A
+{0x00,0x07,0x06,0x06,0x66,0x36,0x1E,0x36,0x66,0x67,0x00,0x00},	// 0x6B
+{0x00,0x1E,0x18,0x18,0x18,0x18,0x18,0x18,0x18,0x7E,0x00,0x00},	// 0x6C
+{0x00,0x00,0x00,0x00,0x3F,0x6B,0x6B,0x6B,0x6B,0x63,0x00,0x00},	// 0x6D
+{0x00,0x00,0x00,0x00,0x1F,0x33,0x33,0x33,0x33,0x33,0x00,0x00},	// 0x6E
+{0x00,0x00,0x00,0x00,0x1E,0x33,0x33,0x33,0x33,0x1E,0x00,0x00},	// 0x6F
+{0x00,0x00,0x00,0x00,0x3B,0x66,0x66,0x66,0x66,0x3E,0x06,0x0F},	// 0x70
+{0x00,0x00,0x00,0x00,0x6E,0x33,0x33,0x33,0x33,0x3E,0x30,0x78},	// 0x71
+{0x00,0x00,0x00,0x00,0x37,0x76,0x6E,0x06,0x06,0x0F,0x00,0x00},	// 0x72
+{0x00,0x00,0x00,0x00,0x1E,0x33,0x06,0x18,0x33,0x1E,0x00,0x00},	// 0x73
+{0x00,0x00,0x04,0x06,0x3F,0x06,0x06,0x06,0x36,0x1C,0x00,0x00},	// 0x74
+{0x00,0x00,0x00,0x00,0x33,0x33,0x33,0x33,0x33,0x6E,0x00,0x00},	// 0x75
+{0x00,0x00,0x00,0x00,0x33,0x33,0x33,0x33,0x1E,0x0C,0x00,0x00},	// 0x76
+{0x00,0x00,0x00,0x00,0x63,0x63,0x6B,0x6B,0x36,0x36,0x00,0x00},	// 0x77
+{0x00,0x00,0x00,0x00,0x63,0x36,0x1C,0x1C,0x36,0x63,0x00,0x00},	// 0x78
+{0x00,0x00,0x00,0x00,0x66,0x66,0x66,0x66,0x3C,0x30,0x18,0x0F},	// 0x79
+{0x00,0x00,0x00,0x00,0x3F,0x31,0x18,0x06,0x23,0x3F,0x00,0x00},	// 0x7A
+{0x00,0x38,0x0C,0x0C,0x06,0x03,0x06,0x0C,0x0C,0x38,0x00,0x00},	// 0x7B
+{0x00,0x18,0x18,0x18,0x18,0x00,0x18,0x18,0x18,0x18,0x00,0x00},	// 0x7C
+{0x00,0x07,0x0C,0x0C,0x18,0x30,0x18,0x0C,0x0C,0x07,0x00,0x00},	// 0x7D
+{0x00,0xCE,0x5B,0x73,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x7E
+{0x00,0x00,0x00,0x08,0x1C,0x36,0x63,0x63,0x7F,0x00,0x00,0x00},	// 0x7F
+{0x00,0x1E,0x33,0x33,0x03,0x03,0x03,0x33,0x33,0x1E,0x0C,0x06},	// 0x80
+{0x00,0x00,0x00,0x00,0xFF,0xFF,0xFF,0xFF,0x00,0x00,0x00,0x00},	// 0x81 S-Meter bar block
+{0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10},	// 0x82 |
+{0x00,0x00,0x00,0x00,0x00,0x00,0xFF,0x00,0x00,0x00,0x00,0x00},	// 0x83 -
+{0x10,0x10,0x10,0x10,0x10,0x10,0xF0,0x00,0x00,0x00,0x00,0x00},	// 0x84 '-
+{0x10,0x10,0x10,0x10,0x10,0x10,0x1F,0x00,0x00,0x00,0x00,0x00},	// 0x85 -'
+{0x00,0x00,0x00,0x00,0x00,0x00,0xF0,0x10,0x10,0x10,0x10,0x10},	// 0x86 ;-
+{0x00,0x00,0x00,0x00,0x00,0x00,0x1F,0x10,0x10,0x10,0x10,0x10},	// 0x87 -;
+{0x00,0x08,0x14,0x08,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x88 ° 
+};
+
+  ///////////////////////
+ //   LCD DRAWING     //
+///////////////////////
+//Set a pixel (Not used, just for academic purposes!)
+void lcd_setpixel(int x, int y, unsigned int color)
+{
+	lcd_setwindow(x, y, x, y);
+	lcd_write_command(ST7735_RAMWR);		// RAM access set
+	lcd_fill_pixels(color, 1);
+}
+
+//Fill rectangle x0:x1, y0:y1 (inclusive), window is set once
+void lcd_fill_rect(int x0, int y0, int x1, int y1, unsigned int color)
+{
+	if((x1 < x0) || (y1 < y0))
+	{
+		return;
+	}
+		
+	lcd_setwindow(x0, y0, x1, y1);
+	lcd_write_command(ST7735_RAMWR);		// RAM access set
+	lcd_fill_pixels(color, (x1 - x0 + 1) * (y1 - y0 + 1));
+}	
+
+//Horizontal line of len pixels from x, y
+void lcd_hline(int x, int y, int len, unsigned int color)
+{
+	lcd_fill_rect(x, y, x + len - 1, y, color);
+}	
+
+//Vertical line of len pixels from x, y
+void lcd_vline(int x, int y, int len, unsigned int color)
+{
+	lcd_fill_rect(x, y, x, y + len - 1, color);
+}	
+
+//Copy w * h pixels from buf to x, y
+//With LCD_HW_SPI buf must not be touched before next lcd_wait()
+void lcd_blit(int x, int y, int w, int h, const uint16_t *buf)
+{
+	lcd_setwindow(x, y, x + w - 1, y + h - 1);
+	lcd_write_command(ST7735_RAMWR);
+	lcd_write_pixels(buf, w * h);
+}	
+
+//Clear full LCD (132x132 controller RAM) with background color
+void lcd_cls0(unsigned int bgcolor)
+{
+	lcd_fill_rect(0, 0, 131, 131, bgcolor);
+}	
+
+//Clear part of LCD with background color
+void lcd_cls1(int x0, int y0, int x1, int y1, unsigned int bgcolor)
+{
+	lcd_fill_rect(x0, y0, x1, y1, bgcolor);
+}	
+
+//Expand char to pixel buffer
+static void glyph_expand(uint16_t *dst, unsigned char ch0, unsigned int fcol, unsigned int bcol, int sx, int sy)
+{
+	int x, y, t1, t2;
+	unsigned char ch;
+	
+	for(y = 0; y < FONTHEIGHT - 1; y++)
+	{
+		ch = xchar[ch0 - CHAROFFSET][y]; 
+	    for(t1 = 0; t1 < sy; t1++)
+	    {
+	        for(x = 0; x < FONTWIDTH; x++)
+	        {
+				for(t2 = 0; t2 < sx; t2++)
+				{
+		            *dst++ = ((1 << x) & ch) ? fcol : bcol;
+		        }    
+		    }
+	    }	
+	}
+}		
+
+//Get stretched char from glyph cache, expand it into the least
+//recently used slot if not present
+uint16_t *glyph_get(unsigned char ch0, unsigned int fcol, unsigned int bcol, int sx, int sy)
+{
+	int t1, lru = 0;
+	struct glyph_slot *g;
+	
+	glyph_stamp++;
+	for(t1 = 0; t1 < GLYPH_CACHE_SLOTS; t1++)
+	{
+		g = &glyph_cache[t1];
+		if(g->used && g->ch == ch0 && g->fcol == fcol && g->bcol == bcol && g->sx == sx && g->sy == sy)
+		{
+			g->used = glyph_stamp;
+			return g->pix;
+		}
+		if(g->used < glyph_cache[lru].used)
+		{
+			lru = t1;
+		}	
+	}
+	
+	lcd_wait(); //Slot to be replaced may still be in transfer
+	g = &glyph_cache[lru];
+	g->ch = ch0;
+	g->fcol = fcol;
+	g->bcol = bcol;
+	g->sx = sx;
+	g->sy = sy;
+	g->used = glyph_stamp;
+	glyph_expand(g->pix, ch0, fcol, bcol, sx, sy);
+	
+	return g->pix;
+}	
+
+//Print one character to given coordinates to the screen
+//sx and sy define "stretch factor"
+//Character is expanded to lcd_pixbuf and sent in one burst,
+//stretched chars up to 2x2 are sent from the glyph cache
+void lcd_putchar(int x0, int y0, unsigned char ch0, unsigned int fcol, unsigned int bcol, int sx, int sy)
+{
+	int x, y, t1, t2, p = 0;
+	unsigned char ch;
+	int n = FONTWIDTH * sx * (FONTHEIGHT - 1) * sy;
+	
+	if((sx > 1 || sy > 1) && n <= LCD_PIXBUF_SIZE)
+	{
+		lcd_blit(x0 + 2, y0 + 2, FONTWIDTH * sx, (FONTHEIGHT - 1) * sy, glyph_get(ch0, fcol, bcol, sx, sy));
+		return;
+	}
+	
+    lcd_setwindow(x0 + 2, y0 + 2, x0 + FONTWIDTH * sx + 1, y0 + FONTHEIGHT * sy);
+	lcd_write_command(ST7735_RAMWR);
+	
+	for(y = 0; y < FONTHEIGHT - 1; y++)
+	{
+		ch = xchar[ch0 - CHAROFFSET][y]; 
+	    for(t1 = 0; t1 < sy; t1++)
+	    {
+			if(p + FONTWIDTH * sx > LCD_PIXBUF_SIZE) //Only for stretch > 2: send what we have
+			{
+				lcd_write_pixels(lcd_pixbuf, p);
+				lcd_wait();
+				p = 0;
+			}
+				
+	        for(x = 0; x < FONTWIDTH; x++)
+	        {
+		        if((1 << x) & ch)
+		        {
+					for(t2 = 0; t2 < sx; t2++)
+					{
+			            lcd_pixbuf[p++] = fcol;
+			        }    
+			    }
+	   	        else	
+		        {
+					for(t2 = 0; t2 < sx; t2++)
+					{
+			            lcd_pixbuf[p++] = bcol;
+			        }    
+			    }   
+		    }
+	    }	
+	}
+	lcd_write_pixels(lcd_pixbuf, p);
+}	
+
+//Print one \0 terminated string to given coordinates to the screen
+//xf and yf define "stretch factor"
+void lcd_putstring(int x0, int y0, char *s, unsigned int fcol, unsigned int bcol, int xf, int yf)
+{
+	int x = 0;
+	
+	while(*s)
+	{
+		lcd_putchar(x + x0, y0, *(s++), fcol, bcol, xf, yf);
+		x += (FONTWIDTH * xf);
+	}	
+}
+
+
+//Print a number
+//xf and yf define "stretch factor"
+int lcd_putnumber(int col, int row, long num, int dec, int fcolor, int bcolor, int xf, int yf)
+{
+    char s[16];
+    int slen = int2asc(num, dec, s, 16);
+    
+	lcd_putstring(col, row, s, fcolor, bcolor, xf, yf);
+	return slen;
+}
+
+//////////////////////
+// STRING FUNCTIONS //
+//////////////////////
+//INT 2 ASC: Put a number to the screen (with decimal separator if needed)
+//Digits are generated from right to left in one pass, so there are no
+//leading zeros to remove. Buffer is supplied by caller, no heap used.
+int int2asc(long num, int dec, char *buf, int buflen)
+{
+    char tmp[16];
+    int p = 0, d = 0, c = 0;
+    unsigned long n;
+
+    if(num < 0)
+    {
+	    n = -num;
+    }
+    else
+    {
+	    n = num;
+    }
+
+    do
+    {
+	    tmp[p++] = '0' + n % 10;   //Division by constant: multiply, no divide loop
+	    n /= 10;
+	    if(++d == dec)
+	    {
+	        tmp[p++] = '.';
+	    }
+    }
+    while(n || d <= dec);          //At least one digit before separator
+
+    //Add minus-sign if neccessary
+    if(num < 0)
+    {
+	    tmp[p++] = '-';
+    }
+
+    //Copy in reverse order
+    while(p && c < buflen - 1)
+    {
+	    buf[c++] = tmp[--p];
+    }
+    buf[c] = 0;
+	
+	return c;
+}
+
+//Frequency in Hz to kHz string with 100 Hz resolution ("14200.0")
+int freq2asc(long f, char *buf, int buflen)
+{
+	return int2asc(f / 100, 1, buf, buflen);
+}	
+
+  ///////////////////////
+ //   S-METER         //
+///////////////////////
+//Smooth value, track peak (now in ms). Returns the smoothed value if
+//the display has to follow, else -1
+int meter_update(int sv, unsigned long now)
+{
+	static int sv_posted = -1, smax_posted = -1;
+	int k = ((sv << 4) > sv_filt) ? METER_ATTACK : METER_RELEASE;
+
+	sv_filt += ((sv << 4) - sv_filt) / (1 << k);
+	sv = (sv_filt + 8) >> 4;
+
+	if(sv >= smax)
+	{
+		smax = sv;
+		smax_t = now;
+	}
+	else if(now - smax_t > METER_HOLD)
+	{
+		smax -= METER_DECAY;
+		if(smax < sv)
+		{
+			smax = sv;
+		}
+	}
+
+	if((sv != sv_posted) || (smax != smax_posted) || (sv && !sv_old)) //Or bar cleared by draw_screen()
+	{
+		sv_posted = sv;
+		smax_posted = smax;
+		return sv;
+	}
+	return -1;
+}
+
+//Meter: only columns that changed since last call are drawn
+void draw_meter(int sv0, int peak)
+{
+    int sv = sv0;
+    
+    if(sv > METERW)
+    {
+		sv = METERW;
+	}	
+	if(sv < 0)
+	{
+		sv = 0;
+	}	
+				    
+	//Bar: columns 0:sv-1 lit
+	if(sv > sv_old)
+	{
+		draw_meter_range(sv_old, sv - 1);
+	}
+	if(sv < sv_old)
+	{
+		draw_meter_bar(sv, sv_old - 1, backcolor);
+	}	
+	sv_old = sv;
+	
+	//Peak marker, only outside of bar
+	if(peak >= METERW)
+	{
+		peak = METERW - 1;
+	}	
+	if(peak < sv)
+	{
+		peak = -1;
+	}	
+	if(peak != smax_shown)
+	{
+		if(smax_shown >= sv) //Old marker not covered by bar
+		{
+			draw_meter_bar(smax_shown, smax_shown, backcolor);
+		}
+		if(peak >= 0)
+		{
+			draw_meter_bar(peak, peak, WHITE);
+		}
+		smax_shown = peak;
+	}		
+}
+
+//Lit columns x0:x1 in color of scale segment
+void draw_meter_range(int x0, int x1)
+{
+	int seg0[] = {0, 66, 89};
+	int seg1[] = {65, 88, METERW - 1};
+	int fcol[] = {GREEN, LIGHTYELLOW, LIGHTRED};
+	int t1, a, b;
+	
+	for(t1 = 0; t1 < 3; t1++)
+	{
+		a = (x0 > seg0[t1]) ? x0 : seg0[t1];
+		b = (x1 < seg1[t1]) ? x1 : seg1[t1];
+		if(a <= b)
+		{
+			draw_meter_bar(a, b, fcol[t1]);
+		}
+	}
+}		
+
+//S-Meter bargraph 
+void draw_meter_bar(int x0, int x1, int fcol)
+{
+	lcd_fill_rect(x0 + 2, METERY, x1 + 2, METERY + METERH - 1, fcol);
+}	
+
+//Get adc value for S-meter
+int get_sval(void)
+{
+    int adcval =  get_adc(MTR) >> 4;
+	return adcval;	
+}
+
+  ///////////////////////
+ //   DDS             //
+///////////////////////
+//Set reference clock (Hz) and precompute FTW scale factor
+//Values more than 0.5% off nominal are rejected 
+void dds_set_clock(unsigned long clk)
+{
+	if(clk < DDS_CLOCK - DDS_CLOCK / 200 || clk > DDS_CLOCK + DDS_CLOCK / 200)
+	{
+		clk = DDS_CLOCK;
+	}	
+	dds_clock = clk;
+	dds_ftw_scale = 0xFFFFFFFFFFFFFFFFULL / clk;
+}
+
+//Frequency tuning word: FTW = f * 2^32 / fClk, 64-bit integer, rounded
+unsigned long dds_ftw(unsigned long f)
+{
+	return ((unsigned long long) f * dds_ftw_scale + 0x80000000ULL) >> 32;
+}
+
+//Set frequency for AD9951 DDS
+void set_frequency(unsigned long frequency)
+{
+	dds_write_ftw(dds_ftw(frequency + INTERFREQUENCY));
+}
+
+  //////////////////////
+ // Si5351A commands //
+//////////////////////
+//Write n registers starting at reg, only the range that differs from
+//the shadow copy is sent, as one auto-increment burst
+void si5351_write_regs(int reg, uint8_t *data, int n)
+{
+  uint8_t buf[SI5351_MAXBURST + 1];
+  int first = 0, last = n - 1, t1;
+  
+  while(first < n && si5351_known[reg + first] && si5351_shadow[reg + first] == data[first])
+  {
+	  first++;
+  }
+  if(first == n)
+  {
+	  return; //Nothing changed
+  }
+  while(si5351_known[reg + last] && si5351_shadow[reg + last] == data[last])
+  {
+	  last--;
+  }
+  
+  buf[0] = reg + first;
+  for(t1 = first; t1 <= last; t1++)
+  {
+	  buf[t1 - first + 1] = data[t1];
+	  si5351_shadow[reg + t1] = data[t1];
+	  si5351_known[reg + t1] = 1;
+  }
+  si5351_bus_write(buf, last - first + 2);
+}  
+
+//Failed burst: chip state of n registers from reg is unknown, the
+//next write must not be suppressed by the shadow (ISR context)
+void si5351_invalidate(int reg, int n)
+{
+  int t1;
+
+  for(t1 = 0; t1 < n; t1++)
+  {
+	  si5351_known[reg + t1] = 0;
+  }
+}
+
+//Reset PLLA and PLLB (self clearing, not cached)
+static void si5351_pll_reset(void)
+{
+  uint8_t r[2] = {PLL_RESET, (1 << 5)};
+
+  si5351_bus_write(r, 2);
+}
+
+//Write single register through shadow copy
+void si5351_write_reg(int reg, uint8_t value)
+{
+  si5351_write_regs(reg, &value, 1);
+}  
+
+//Set PLLA (VCO) to FXTAL * PLLRATIO until the first frequency is set
+//In this example PLLB is not used
+//Equation fVCO = fXTAL * (a+b/c) => see AN619 p.3
+void si5351_start(void)
+{
+  uint8_t r[8];
+    
+  //Init
+  si5351_write_reg(PLLX_SRC, 0);              //Select XTAL as clock source for si5351C
+  si5351_write_reg(SPREAD_SPECTRUM_PARAMETERS, 0); //Spread spectrum diasble (Si5351 A or B only!
+  si5351_write_reg(XTAL_LOAD_CAP, 0xD2);      // Set crystal load capacitor to 10pF (default), 
+                                       // for bits 5:0 see also AN619 p. 60
+  si5351_write_reg(CLK_ENABLE_CONTROL, 0x00); // Enable all outputs
+  r[0] = 0x4E;                                // Set PLLA to CLK0, 8 mA output, MS0 integer mode (even divider)
+  r[1] = 0x0E;                                // Set PLLA to CLK1, 8 mA output
+  r[2] = 0x0E;                                // Set PLLA to CLK2, 8 mA output
+  si5351_write_regs(CLK0_CONTROL, r, 3);
+  si5351_pll_reset();
+
+  si5351_pack(PLLRATIO, 0, SI5351_DEN, r);
+  si5351_write_regs(SYNTH_PLL_A, r, 8);
+}
+
+//Largest even multisynth divider that keeps the VCO <= SI5351_VCO_MAX
+unsigned long si5351_div(long freq)
+{
+  unsigned long d = (SI5351_VCO_MAX / freq) & ~1UL;
+  
+  if(d < 8)
+  {
+	  d = 8;
+  }
+  if(d > 1800)
+  {
+	  d = 1800;
+  }	  
+  return d;
+}	  
+
+//a + b/c to the 8 parameter registers of a PLL or multisynth (AN619 p.3)
+void si5351_pack(unsigned long a, unsigned long b, unsigned long c, uint8_t *r)
+{
+  unsigned long t = (b << 7) / c;    //floor(128 * b / c), b < 2^20
+  unsigned long p1 = (a << 7) + t - 512;
+  unsigned long p2 = (b << 7) - c * t;
+  unsigned long p3 = c;
+  
+  r[0] = (p3 >> 8) & 0xFF;
+  r[1] = p3 & 0xFF;
+  r[2] = (p1 >> 16) & 0x03;
+  r[3] = (p1 >> 8) & 0xFF;
+  r[4] = p1 & 0xFF;
+  r[5] = ((p3 >> 12) & 0xF0) | ((p2 >> 16) & 0x0F);
+  r[6] = (p2 >> 8) & 0xFF;
+  r[7] = p2 & 0xFF;
+}	  
+
+//PLLA and multisynth register values for freq with even integer divider
+//div (no register access). Only the PLL fraction follows freq, so a
+//small step changes P2 and seldom P1: 3..5 bytes after the shadow cache.
+void si5351_calc(long freq, unsigned long div, uint8_t *pll, uint8_t *ms)
+{
+  uint64_t vco = (uint64_t) freq * div;
+  unsigned long a = vco / FXTAL;
+  unsigned long b = (((vco % FXTAL) * SI5351_DEN) + FXTAL / 2) / FXTAL;
+  
+  if(b == SI5351_DEN) //Rounded up to next integer
+  {
+	  a++;
+	  b = 0;
+  }
+  si5351_pack(a, b, SI5351_DEN, pll);
+  si5351_pack(div, 0, 1, ms);
+}
+
+//Write precomputed registers, PLLA is reset only if the divider changed
+void si5351_load(int synth, uint8_t *pll, uint8_t *ms)
+{
+  int t1, newdiv = 0;
+  
+  for(t1 = 0; t1 < 8; t1++)
+  {
+	  if(!si5351_known[synth + t1] || si5351_shadow[synth + t1] != ms[t1])
+	  {
+		  newdiv = 1;
+	  }
+  }
+  
+  si5351_write_regs(synth, ms, 8);
+  si5351_write_regs(SYNTH_PLL_A, pll, 8);
+  if(newdiv)
+  {
+	  si5351_pll_reset();
+  }	  
+}	
+
+//Set output of synth (only CLK0 is used, PLLA is retuned with it).
+//The divider is kept while the VCO stays in range, so tuning and
+//sideband changes never need a PLL reset.
+void si5351_set_freq(int synth, long freq)
+{
+  uint8_t pll[8], ms[8];
+  uint64_t vco = (uint64_t) freq * si5351_msdiv;
+  
+  if(vco < SI5351_VCO_MIN || vco > SI5351_VCO_MAX)
+  {
+	  si5351_msdiv = si5351_div(freq);
+  }
+  si5351_calc(freq, si5351_msdiv, pll, ms);
+  si5351_load(synth, pll, ms); //Only changed bytes are sent
+}
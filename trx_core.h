@@ -0,0 +1,146 @@
+///////////////////////////////////////////////////////////////////
+//   Portable radio code: drawing, number strings, DDS and       //
+//   Si5351 tuning words, S-meter                                //
+///////////////////////////////////////////////////////////////////
+//No register access, all I/O goes through trx_hal.h. Linked into the
+//firmware and into the host benchmark (host/, CMakeLists.txt).
+
+#ifndef TRX_CORE_H
+#define TRX_CORE_H
+
+#include "trx_hal.h"
+
+//DDS
+#define DDS_CLOCK   400000000 //Nominal reference clock (Hz), measured value is loaded from EEPROM
+#define INTERFREQUENCY 10000000
+
+//Defines for Si5351
+#define FXTAL          25000000 //Hz
+#define PLLRATIO       32       //FXTAL * PLLRATIO = f.VCO after start
+#define SI5351_VCO_MIN 600000000UL
+#define SI5351_VCO_MAX 900000000UL
+#define SI5351_DEN     0xFFFFF  //PLL fraction denominator c, fixed: P3 registers never change
+
+//Set of Si5351A relevant register addresses
+#define CLK_ENABLE_CONTROL          3
+#define PLLX_SRC				   15
+#define CLK0_CONTROL               16 
+#define CLK1_CONTROL               17
+#define CLK2_CONTROL               18
+#define SYNTH_PLL_A                26
+#define SYNTH_PLL_B                34
+#define SYNTH_MS_0                 42
+#define SYNTH_MS_1                 50
+#define SYNTH_MS_2                 58
+#define SPREAD_SPECTRUM_PARAMETERS 149
+#define PLL_RESET                  177
+#define XTAL_LOAD_CAP              183
+#define SI5351_REGS                184 //Size of register shadow
+#define SI5351_MAXBURST              8 //Max. registers per si5351_write_regs() call
+
+//Some sample colors
+//USeful website http://www.barth-dev.de/online/rgb565-color-picker/
+#define WHITE        0xFFFF
+#define BLACK        0x0000
+#define GRAY         0x94B2
+#define LIGHTGRAY    0xC5D7
+
+#define LIGHTBLUE    0x755C
+#define BLUE         0x3C19
+#define DARKBLUE     0x0A73
+#define DARKBLUE2    0x20AA
+
+#define LIGHTRED     0xFA60 //0xE882 // 0xEB2D //0xDAAB
+#define RED          0xF803 //0xB1A7
+#define DARKRED      0x80C3
+
+#define LIGHTGREEN   0x27E0 //0x6E84
+#define GREEN        0x07EA //0x6505
+#define DARKGREEN    0x3B04
+
+#define LIGHTVIOLET  0xAC19
+#define LIGHTVIOLET2 0x9BD9
+#define VIOLET       0x71B6
+#define DARKVIOLET   0x48AF
+
+#define DARKYELLOW   0xB483
+#define YELLOW       0xFF00 //0xE746  0xFD40
+#define YELLOW2      0xFEC0
+#define LIGHTYELLOW  0xF7E0 //0xF752  //0xF7AF
+
+#define LIGHTBROWN   0xF64F
+#define BROWN        0x9323
+#define DARKBROWN    0x6222
+
+
+//Font
+#define FONTWIDTH 8 
+#define FONTHEIGHT 12
+
+#define CHAROFFSET 0x20
+extern const unsigned char xchar[][FONTHEIGHT];
+
+//Pixel buffer for one char (max. stretch 2x2), sent in one burst
+#define LCD_PIXBUF_SIZE (FONTWIDTH * 2 * (FONTHEIGHT - 1) * 2)
+
+
+//S-Meter
+#define METERY 86 //Vertical position for S-Meterbar
+#define METERH  4 //Height of bar
+#define METERW 121 //Columns
+#define METER_ATTACK   2    //Smoothing 1/2^n per update when rising
+#define METER_RELEASE  3    //                           and falling
+#define METER_HOLD  1000    //ms peak is held
+#define METER_DECAY    1    //Columns per update peak falls after hold time
+
+//LCD drawing
+uint16_t *glyph_get(unsigned char, unsigned int, unsigned int, int, int); //Get expanded stretched char from cache
+void lcd_setpixel(int, int, unsigned int);               //Set 1 Pixel
+void lcd_fill_rect(int, int, int, int, unsigned int);    //Fill rectangle, one window, one run
+void lcd_hline(int, int, int, unsigned int);             //Horizontal line x, y, len
+void lcd_vline(int, int, int, unsigned int);             //Vertical line x, y, len
+void lcd_blit(int, int, int, int, const uint16_t*);      //Copy pixel buffer to rectangle
+void lcd_cls0(unsigned int);                             //Clear full controller RAM
+void lcd_cls1(int, int, int, int, unsigned int);         //Clear rectangle
+void lcd_putchar(int, int, unsigned char, unsigned int, unsigned int, int, int); //Write one char to LCD (double size, variable height)
+void lcd_putstring(int, int, char*, unsigned int, unsigned int, int, int);       //Write \0 terminated string to LCD (double size, variable height)
+int lcd_putnumber(int, int, long, int, int, int, int, int);                     //Write a number (int or long) to LCD (double size, variable height)
+
+//String functions
+int int2asc(long, int, char*, int);                                     //Convert an int or long number to a string
+int freq2asc(long, char*, int);                                         //Frequency (Hz) to kHz string with one decimal
+
+//S-Meter
+int meter_update(int, unsigned long);
+void draw_meter(int, int);
+void draw_meter_range(int, int);
+void draw_meter_bar(int, int, int);
+int get_sval(void);
+
+//DDS
+void dds_set_clock(unsigned long);
+unsigned long dds_ftw(unsigned long);
+void set_frequency(unsigned long);
+
+//Si5351
+void si5351_write_regs(int, uint8_t*, int);
+void si5351_write_reg(int, uint8_t);
+void si5351_invalidate(int, int);
+void si5351_start(void);
+unsigned long si5351_div(long);
+void si5351_pack(unsigned long, unsigned long, unsigned long, uint8_t*);
+void si5351_calc(long, unsigned long, uint8_t*, uint8_t*);
+void si5351_load(int, uint8_t*, uint8_t*);
+void si5351_set_freq(int, long);
+
+//Variables
+extern unsigned int backcolor;
+extern uint16_t lcd_pixbuf[LCD_PIXBUF_SIZE];
+extern uint8_t si5351_shadow[SI5351_REGS];
+extern volatile uint8_t si5351_known[SI5351_REGS];
+extern unsigned long si5351_msdiv;
+extern unsigned long dds_clock;
+extern unsigned long long dds_ftw_scale;
+extern int smax, smax_shown, sv_old, sv_filt;
+
+#endif
@@ -0,0 +1,86 @@
+///////////////////////////////////////////////////////////////////
+//     Hardware seam of the portable radio code (trx_core.c)     //
+///////////////////////////////////////////////////////////////////
+//Implemented with the STM32F411 peripherals in 8-band-trx2.c and
+//with mock backends in host/hal_mock.c. No CMSIS header here.
+
+#ifndef TRX_HAL_H
+#define TRX_HAL_H
+
+#include <stdint.h>
+
+//ADC defines
+#define KEYS  1 //ADC channel 4 - PA4
+#define VDD   2 //ADC channel 5 - PA5
+#define MTR   3 //ADC channel 6 - PA6
+#define TMP   4 //ADC channel 7 - PA7
+
+//LCD ST7735 contants
+#define ST7735_NOP     0x00
+#define ST7735_SWRESET 0x01
+#define ST7735_RDDID   0x04
+#define ST7735_RDDST   0x09
+#define ST7735_SLPIN   0x10
+#define ST7735_SLPOUT  0x11
+#define ST7735_PTLON   0x12
+#define ST7735_NORON   0x13
+#define ST7735_INVOFF  0x20
+#define ST7735_INVON   0x21
+#define ST7735_DISPOFF 0x28
+#define ST7735_DISPON  0x29
+#define ST7735_CASET   0x2A
+#define ST7735_RASET   0x2B
+#define ST7735_RAMWR   0x2C
+#define ST7735_RAMRD   0x2E
+#define ST7735_PTLAR   0x30
+#define ST7735_COLMOD  0x3A
+#define ST7735_MADCTL  0x36
+#define ST7735_FRMCTR1 0xB1
+#define ST7735_FRMCTR2 0xB2
+#define ST7735_FRMCTR3 0xB3
+#define ST7735_INVCTR  0xB4
+#define ST7735_DISSET5 0xB6
+#define ST7735_PWCTR1  0xC0
+#define ST7735_PWCTR2  0xC1
+#define ST7735_PWCTR3  0xC2
+#define ST7735_PWCTR4  0xC3
+#define ST7735_PWCTR5  0xC4
+#define ST7735_VMCTR1  0xC5
+#define ST7735_RDID1   0xDA
+#define ST7735_RDID2   0xDB
+#define ST7735_RDID3   0xDC
+#define ST7735_RDID4   0xDD
+#define ST7735_PWCTR6  0xFC
+#define ST7735_GMCTRP1 0xE0
+#define ST7735_GMCTRN1 0xE1
+//LCD transport, pixels are RGB565
+void lcd_write_command(int);                             //Send a command to LCD
+void lcd_write_data(int);                                //Send data to LCD
+void lcd_write_pixels(const uint16_t*, int);             //Stream pixel buffer to LCD RAM (DMA with LCD_HW_SPI)
+void lcd_fill_pixels(unsigned int, int);                 //Stream n pixels of one color to LCD RAM
+void lcd_wait(void);                                     //Wait until pending pixel transfer has finished
+void lcd_setwindow(int, int, int, int);                  //Define output window on LCD
+
+//DDS transport: send tuning word, applied at IO_UD
+void dds_write_ftw(unsigned long);
+
+//Si5351 transport: burst of n bytes, buf[0] is the first register.
+//buf may be reused on return. A burst that fails later must be
+//reported to si5351_invalidate(buf[0], n - 1).
+void si5351_bus_write(uint8_t*, int);
+
+//ADC: mean of the last conversions of channel KEYS..TMP, 12 bit
+int get_adc(int);
+
+//Time base
+unsigned long millis(void);
+
+//Bytes sent/received per bus, counted by the transports (target:
+//with PROFILE only, host: always)
+struct io_stats
+{
+	unsigned long lcd, i2c, dds;
+};
+extern struct io_stats io_stat;
+
+#endif